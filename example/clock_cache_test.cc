@@ -2,12 +2,20 @@
 // Created by zhanghuigui on 2021/7/16.
 //
 
+#include "async_lookup.h"
 #include "cache.h"
+#include "env.h"
 #include "sharded_cache.h"
 #include "gflags/gflags.h"
 
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 DEFINE_int32(clock_cache_size, 1024, "cache size");
 DEFINE_int32(cache_bit, 1, "cache shared bits ");
@@ -30,7 +38,7 @@ void CreateCache() {
 }
 
 void deleter(const Slice& /*key*/, void* value) {
-	delete reinterpret_cast<char *>(value);
+	delete[] reinterpret_cast<char *>(value);
 }
 
 void PrintCacheStats() {
@@ -59,12 +67,134 @@ void CacheErase(std::string key) {
 	// cout << "Erase " << key << " success " << endl;
 }
 
+// The loader of a GetOrCreate() miss fails, by returning nullptr or by
+// throwing, while other callers wait for the same key. Every waiter must be
+// woken with nullptr, and the key must be loadable again afterwards.
+void TestGetOrCreateFailure(bool throws) {
+	const Slice key("get_or_create_key");
+	const int kWaiters = 4;
+	std::atomic<bool> loading(false);
+	std::atomic<int> waiting(0);
+	std::atomic<int> failed(0);
+
+	std::thread loader([&]() {
+		try {
+			Cache::Handle* handle = cache->GetOrCreate(
+					key,
+					[&](const Slice& /*k*/, size_t* /*charge*/) -> void* {
+						// Give the waiters time to block on this load.
+						loading = true;
+						while (waiting.load() < kWaiters) {
+							std::this_thread::yield();
+						}
+						std::this_thread::sleep_for(std::chrono::milliseconds(100));
+						if (throws) {
+							throw std::runtime_error("create failed");
+						}
+						return nullptr;
+					},
+					&deleter);
+			if (handle == nullptr) {
+				failed++;
+			}
+		} catch (const std::runtime_error&) {
+			failed++;
+		}
+	});
+
+	std::vector<std::thread> waiters;
+	for (int i = 0; i < kWaiters; i++) {
+		waiters.emplace_back([&]() {
+			while (!loading.load()) {
+				std::this_thread::yield();
+			}
+			waiting++;
+			Cache::Handle* handle = cache->GetOrCreate(
+					key,
+					[](const Slice& /*k*/, size_t* /*charge*/) -> void* {
+						return nullptr;
+					},
+					&deleter);
+			if (handle == nullptr) {
+				failed++;
+			} else {
+				cache->Release(handle);
+			}
+		});
+	}
+	loader.join();
+	for (auto& t : waiters) {
+		t.join();
+	}
+	if (failed.load() != kWaiters + 1) {
+		cout << "GetOrCreate failure: " << failed.load() << " of "
+				 << kWaiters + 1 << " callers failed" << endl;
+		exit(-1);
+	}
+
+	Cache::Handle* handle = cache->GetOrCreate(
+			key,
+			[](const Slice& /*k*/, size_t* charge) -> void* {
+				*charge = 1;
+				return new char[1];
+			},
+			&deleter);
+	if (handle == nullptr) {
+		cout << "GetOrCreate failure: key not loadable after failed load" << endl;
+		exit(-1);
+	}
+	cache->Release(handle);
+	cache->Erase(key);
+	cout << "GetOrCreate failure (" << (throws ? "throw" : "nullptr")
+			 << ") ok" << endl;
+}
+
+// The LookupAsync() variant: the loader throws on a pool thread while other
+// lookups of the key wait. The loader's future must rethrow, the waiters'
+// futures must yield nullptr, and the process must survive.
+void TestLookupAsyncFailure() {
+	const Slice key("lookup_async_key");
+	const int kLookups = 4;
+	Env::Default()->SetBackgroundThreads(kLookups, Env::LOW);
+	std::vector<std::future<Cache::Handle*>> results;
+	for (int i = 0; i < kLookups; i++) {
+		results.push_back(LookupAsync(
+				cache, key,
+				[](const Slice& /*k*/, size_t* /*charge*/) -> void* {
+					// Give the other lookups time to wait on this load.
+					std::this_thread::sleep_for(std::chrono::milliseconds(100));
+					throw std::runtime_error("load failed");
+				},
+				&deleter));
+	}
+	int thrown = 0;
+	int failed = 0;
+	for (auto& result : results) {
+		try {
+			Cache::Handle* handle = result.get();
+			if (handle == nullptr) {
+				failed++;
+			} else {
+				cache->Release(handle);
+			}
+		} catch (const std::runtime_error&) {
+			thrown++;
+		}
+	}
+	if (thrown == 0 || thrown + failed != kLookups) {
+		cout << "LookupAsync failure: " << thrown << " threw, " << failed
+				 << " failed of " << kLookups << endl;
+		exit(-1);
+	}
+	cout << "LookupAsync failure ok" << endl;
+}
+
 int main(int argc, char* argv[]) {
 	gflags::ParseCommandLineFlags(&argc, &argv, true);
 	CreateCache();
 	cout << "Insert " << endl;
 	for (uint64_t i = 1; i < FLAGS_key_nums; i ++) {
-		CacheInsert("key" + std::to_string(RandNum(FLAGS_key_nums)), new char[10]);
+		CacheInsert("key" + std::to_string(RandNum(FLAGS_key_nums)), new char[10]());
 	}
 	PrintCacheStats();
 
@@ -79,4 +209,9 @@ int main(int argc, char* argv[]) {
 		CacheErase("key" + std::to_string(RandNum(FLAGS_key_nums)));
 	}
 	PrintCacheStats();
+
+	cout << "GetOrCreate " << endl;
+	TestGetOrCreateFailure(false);
+	TestGetOrCreateFailure(true);
+	TestLookupAsyncFailure();
 }
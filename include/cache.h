@@ -4,12 +4,17 @@
 
 #pragma once
 #include <stdint.h>
+#include <string.h>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
+#include "hash.h"
 #include "memory_alloctor.h"
 #include "slice.h"
 
 class Cache;
+class Env;
 
 extern const bool kDefaultToAdaptiveMutex;
 
@@ -53,6 +58,26 @@ struct LRUCacheOptions {
 	// -DROCKSDB_DEFAULT_TO_ADAPTIVE_MUTEX, false otherwise.
 	bool use_adaptive_mutex = kDefaultToAdaptiveMutex;
 
+	// If greater than zero, the deleters of evicted and erased entries run on
+	// this many background threads instead of the thread that dropped the
+	// last reference. Deletions waiting for a background thread are bounded
+	// to a fraction of the capacity; beyond that, callers delete inline.
+	int async_deleter_threads = 0;
+
+	// If true, the memory the cache spends on its own bookkeeping is charged
+	// against the capacity as well: the per-entry handle and key copy (as
+	// reported by the allocator) and the hash table. GetUsage() then reflects
+	// the real footprint and GetMetadataUsage() reports the bookkeeping part.
+	bool metadata_charged = false;
+
+	// If true, each shard takes its entries, and hash table arrays of at least
+	// 2MB, from 2MB-aligned regions backed by huge pages (MAP_HUGETLB if huge
+	// pages are reserved, transparent huge pages otherwise). This cuts TLB
+	// misses for caches of several GB, at the cost of up to 2MB of mapped but
+	// unused memory per shard. Freed entry memory is recycled by the shard
+	// and only returned to the system when the cache is destroyed.
+	bool use_huge_page_arena = false;
+
 	LRUCacheOptions() {}
 	LRUCacheOptions(size_t _capacity, int _num_shard_bits,
 									bool _strict_capacity_limit, double _high_pri_pool_ratio,
@@ -91,6 +116,53 @@ extern std::shared_ptr<Cache> NewClockCache(size_t capacity,
 																						int num_shard_bits = -1,
 																						bool strict_capacity_limit = false);
 
+struct ClockCacheOptions {
+	// Capacity of the cache.
+	size_t capacity = 0;
+
+	// Cache is sharded into 2^num_shard_bits shards, by hash of key.
+	// -1 means it is automatically determined, as for NewLRUCache.
+	int num_shard_bits = -1;
+
+	// If strict_capacity_limit is set,
+	// insert to the cache will fail when cache is full.
+	bool strict_capacity_limit = false;
+
+	// See LRUCacheOptions::async_deleter_threads.
+	int async_deleter_threads = 0;
+
+	// See LRUCacheOptions::metadata_charged.
+	bool metadata_charged = false;
+
+	ClockCacheOptions() {}
+	ClockCacheOptions(size_t _capacity, int _num_shard_bits,
+										bool _strict_capacity_limit)
+	: capacity(_capacity),
+		num_shard_bits(_num_shard_bits),
+		strict_capacity_limit(_strict_capacity_limit) {}
+};
+
+extern std::shared_ptr<Cache> NewClockCache(const ClockCacheOptions& cache_opts);
+
+// A key together with its hash. A request that looks a key up, inserts it
+// on a miss and erases it later can hash it once and pass the HashedKey to
+// the Cache overloads that take one.
+//
+// HashedKey(key) uses the same hash the cache computes for a plain Slice.
+// A caller that already has a 64-bit hash of its keys can pass that
+// instead; it is truncated to 32 bits, so its low bits must be well mixed.
+// A key must then always be given to the cache with that hash, since an
+// entry inserted under one hash is not found under another.
+struct HashedKey {
+	explicit HashedKey(const Slice& _key)
+	: key(_key), hash(static_cast<uint32_t>(GetSliceNPHash64(_key))) {}
+	HashedKey(const Slice& _key, uint64_t _hash)
+	: key(_key), hash(static_cast<uint32_t>(_hash)) {}
+
+	Slice key;
+	uint32_t hash;
+};
+
 class Cache {
 public:
 	// Depending on implementation, cache entries with high priority could be less
@@ -132,6 +204,30 @@ public:
 												Handle** handle = nullptr,
 												Priority priority = Priority::LOW) = 0;
 
+	// Insert n entries, as Insert(keys[i], values[i], charges[i], deleter)
+	// with no handle would, including dropping the ones that do not fit.
+	// Meant for bulk fills such as warm-up or readahead: implementations can
+	// allocate outside their locks and make room for the whole batch at once.
+	virtual void MultiInsert(const Slice* keys, void* const* values,
+													 const size_t* charges, size_t n,
+													 void (*deleter)(const Slice& key, void* value),
+													 Priority priority = Priority::LOW) {
+		for (size_t i = 0; i < n; i++) {
+			Insert(keys[i], values[i], charges[i], deleter, nullptr, priority);
+		}
+	}
+
+	// Insert(), Lookup() and Erase() for a key that has already been hashed.
+	// Implementations that do not hash keys ignore the hash.
+	virtual bool Insert(const HashedKey& key, void* value, size_t charge,
+											void (*deleter)(const Slice& key, void* value),
+											Handle** handle = nullptr,
+											Priority priority = Priority::LOW) {
+		return Insert(key.key, value, charge, deleter, handle, priority);
+	}
+	virtual Handle* Lookup(const HashedKey& key) { return Lookup(key.key); }
+	virtual void Erase(const HashedKey& key) { Erase(key.key); }
+
 	// If the cache has no mapping for "key", returns nullptr.
 	//
 	// Else return a handle that corresponds to the mapping.  The caller
@@ -141,6 +237,96 @@ public:
 	// function.
 	virtual Handle* Lookup(const Slice& key) = 0;
 
+	// Look up n keys at once. handles[i] is set as Lookup(keys[i]) would
+	// return it, and each non-null handle must be released. Cheaper than n
+	// Lookup() calls for implementations that can amortize locking and hide
+	// memory latency across the batch.
+	virtual void MultiLookup(const Slice* keys, size_t n, Handle** handles) {
+		for (size_t i = 0; i < n; i++) {
+			handles[i] = Lookup(keys[i]);
+		}
+	}
+
+	// Reads the value of an entry for Get().
+	typedef std::function<void(void* value, size_t charge)> ReadCallback;
+
+	// Run reader on the value of key while the entry is protected from
+	// eviction and erase, without handing out a Handle. Returns false without
+	// calling reader if key is not in the cache. This replaces Lookup(),
+	// Value() and Release() with a single shard lock or table access.
+	// REQUIRES: reader must be short and must not call into this cache.
+	virtual bool Get(const Slice& key, const ReadCallback& reader) {
+		Handle* handle = Lookup(key);
+		if (handle == nullptr) {
+			return false;
+		}
+		reader(Value(handle), GetCharge(handle));
+		Release(handle);
+		return true;
+	}
+
+	// For values that point to plain data: copy the value of key into buf and
+	// set *value_size to its length in bytes, which value_length computes from
+	// the value and its charge (the charge is an accounting unit and need not
+	// be a byte count). Returns false on a miss or if the value does not fit
+	// buf_size bytes.
+	bool GetCopy(const Slice& key,
+							 size_t (*value_length)(const void* value, size_t charge),
+							 char* buf, size_t buf_size, size_t* value_size) {
+		// Captured through one pointer so the std::function stays in its
+		// small-object buffer instead of allocating.
+		struct Copy {
+			size_t (*value_length)(const void* value, size_t charge);
+			char* buf;
+			size_t buf_size;
+			size_t* value_size;
+			bool fits;
+		} copy = {value_length, buf, buf_size, value_size, false};
+		Copy* c = &copy;
+		bool found = Get(key, [c](void* value, size_t charge) {
+			size_t length = c->value_length(value, charge);
+			*c->value_size = length;
+			if (length <= c->buf_size) {
+				memcpy(c->buf, value, length);
+				c->fits = true;
+			}
+		});
+		return found && copy.fits;
+	}
+
+	// Produces the value for a key that GetOrCreate() did not find. Sets
+	// *charge and returns the value, or returns nullptr on failure.
+	typedef std::function<void*(const Slice& key, size_t* charge)>
+			CreateCallback;
+
+	// Return a handle to the entry for key, calling create and inserting its
+	// value with deleter and priority if the key is missing. The caller must
+	// Release() the handle. Returns nullptr if create fails, or if the value
+	// cannot be inserted because of strict_capacity_limit; the value has been
+	// passed to deleter in that case.
+	//
+	// Implementations may coalesce concurrent misses on the same key, so that
+	// create runs on one caller while the others wait for its entry. A failed
+	// create then fails every caller that waited on it.
+	virtual Handle* GetOrCreate(const Slice& key, const CreateCallback& create,
+															void (*deleter)(const Slice& key, void* value),
+															Priority priority = Priority::LOW) {
+		Handle* handle = Lookup(key);
+		if (handle != nullptr) {
+			return handle;
+		}
+		size_t charge = 0;
+		void* value = create(key, &charge);
+		if (value == nullptr) {
+			return nullptr;
+		}
+		if (!Insert(key, value, charge, deleter, &handle, priority)) {
+			(*deleter)(key, value);
+			return nullptr;
+		}
+		return handle;
+	}
+
 	// Increments the reference count for the handle if it refers to an entry in
 	// the cache. Returns true if refcount was incremented; otherwise, returns
 	// false.
@@ -177,6 +363,12 @@ public:
 	// its cache keys.
 	virtual uint64_t NewId() = 0;
 
+	// Erase every entry whose key starts with id, as 8 native-endian bytes,
+	// in O(1): the entries become misses at once and their memory is
+	// reclaimed lazily by eviction. Entries of other namespaces may be
+	// dropped too. Returns false if the cache does not support namespaces.
+	virtual bool EraseNamespace(uint64_t /*id*/) { return false; }
+
 	// sets the maximum configured capacity of the cache. When the new
 	// capacity is less than the old capacity and the existing usage is
 	// greater than new capacity, the implementation will do its best job to
@@ -203,6 +395,36 @@ public:
 	// returns the memory size for the entries in use by the system
 	virtual size_t GetPinnedUsage() const = 0;
 
+	// returns the memory size the cache spends on its own bookkeeping (entry
+	// headers, key copies, hash table) and charges against the capacity. It is
+	// included in GetUsage(). Zero unless the cache charges its metadata.
+	virtual size_t GetMetadataUsage() const { return 0; }
+
+	// sets *usage to the usage of each shard, to tell how evenly the entries
+	// spread over the shards. Empty for caches that are not sharded.
+	virtual void GetShardUsage(std::vector<size_t>* usage) const {
+		usage->clear();
+	}
+
+	// Reserve charge bytes of capacity for memory that lives outside the
+	// cache, such as memtables or decompression buffers, so that it shares the
+	// cache's budget. The reservation is pinned charge without an entry: it
+	// counts against the capacity of the shard that hash maps to, and is
+	// included in GetUsage() and GetPinnedUsage().
+	//
+	// Reserving is a single atomic add; entries it displaces are evicted by
+	// the shard's next insert. If strict_capacity_limit is set and the charge
+	// does not fit, nothing is reserved and false is returned. Release with
+	// Unreserve() and the same hash and charge. CacheReservationManager
+	// drives these in fixed-size units and is what most callers want.
+	//
+	// Returns false if the cache does not support reservations.
+	virtual bool Reserve(uint32_t /*hash*/, size_t /*charge*/) { return false; }
+	virtual void Unreserve(uint32_t /*hash*/, size_t /*charge*/) {}
+
+	// returns the capacity currently held by reservations.
+	virtual size_t GetReservedUsage() const { return 0; }
+
 	// returns the charge for the specific entry in the cache.
 	virtual size_t GetCharge(Handle* handle) const = 0;
 
@@ -221,6 +443,46 @@ public:
 	virtual void ApplyToAllCacheEntries(void (*callback)(void*, size_t),
 																			bool thread_safe) = 0;
 
+	// Visits an entry for ApplyToAllEntries(). Returns false to stop.
+	typedef std::function<bool(const Slice& key, void* value, size_t charge)>
+			EntryCallback;
+
+	// Apply callback to all entries in the cache without freezing a shard for
+	// the whole walk: each shard is visited in chunks of about
+	// entries_per_lock entries, with one lock hold per chunk. An entry that
+	// stays in the cache for the whole walk is visited exactly once; entries
+	// inserted or erased meanwhile may or may not be. Stops early once
+	// callback returns false.
+	//
+	// If env is not nullptr, shards are visited concurrently on its LOW
+	// thread pool as well as by the caller, so callback must be thread-safe.
+	// REQUIRES: callback must not call into this cache.
+	//
+	// The default, for caches that do not override it, is built on
+	// ApplyToAllCacheEntries(thread_safe = true): it passes an empty key and
+	// ignores entries_per_lock and env.
+	virtual void ApplyToAllEntries(const EntryCallback& callback,
+																 size_t /*entries_per_lock*/ = 256,
+																 Env* /*env*/ = nullptr) {
+		// ApplyToAllCacheEntries() takes a plain function pointer, so the
+		// walk's state reaches it through a thread_local.
+		struct Walk {
+			const EntryCallback* callback;
+			bool stopped;
+		};
+		static thread_local Walk* walk = nullptr;
+		Walk w = {&callback, false};
+		walk = &w;
+		ApplyToAllCacheEntries(
+				[](void* value, size_t charge) {
+					if (!walk->stopped && !(*walk->callback)(Slice(), value, charge)) {
+						walk->stopped = true;
+					}
+				},
+				true);
+		walk = nullptr;
+	}
+
 	// Remove all entries.
 	// Prerequisite: no entry is referenced.
 	virtual void EraseUnRefEntries() = 0;
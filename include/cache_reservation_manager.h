@@ -0,0 +1,64 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+#include "cache.h"
+#include "port.h"
+
+// CacheReservationManager charges memory owned outside a cache (memtables,
+// decompression buffers, ...) against the cache's capacity, so several
+// consumers and the cache share one memory budget.
+//
+// The reservation follows the consumer's memory usage in units of
+// kUnitSize through Cache::Reserve(). Units are spread over the cache's
+// shards; each one costs a single atomic add on its shard. To avoid
+// flapping, the reservation only shrinks once usage drops below 3/4 of it.
+//
+// All reserved capacity is released when the manager is destroyed. The
+// methods are thread-safe.
+class CacheReservationManager {
+ public:
+  static const size_t kUnitSize = 256 * 1024;
+
+  explicit CacheReservationManager(std::shared_ptr<Cache> cache);
+  ~CacheReservationManager();
+
+  // Grow or shrink the reservation to cover new_memory_used bytes, rounded
+  // up to whole units. Returns false if the cache has a strict capacity
+  // limit and could not make room for all of it; the units that did fit
+  // stay reserved.
+  bool UpdateCacheReservation(size_t new_memory_used);
+
+  // Bytes currently reserved in the cache.
+  size_t GetTotalReservedCacheSize() const;
+
+  // The value last passed to UpdateCacheReservation().
+  size_t GetTotalMemoryUsed() const;
+
+ private:
+  // Shard selector for the i-th unit. Fibonacci hashing of consecutive
+  // units spreads them over the top bits the cache shards by, and the
+  // per-manager seed keeps managers of the same cache from starting on the
+  // same shard.
+  uint32_t UnitHash(size_t unit) const {
+    return static_cast<uint32_t>((seed_ + unit) * 0x9E3779B9u);
+  }
+
+  std::shared_ptr<Cache> cache_;
+  const uint64_t seed_;
+
+  mutable port::Mutex mutex_;
+  size_t num_units_;
+  size_t memory_used_;
+
+  // No copying allowed
+  CacheReservationManager(const CacheReservationManager&);
+  void operator=(const CacheReservationManager&);
+};
@@ -56,8 +56,10 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <atomic>
 #include <limits>
 #include <string>
+#include <vector>
 
 #include <machine/endian.h>
 #if defined(__DARWIN_LITTLE_ENDIAN) && defined(__DARWIN_BYTE_ORDER)
@@ -105,6 +107,28 @@ namespace port {
 	static const bool kLittleEndian = PLATFORM_IS_LITTLE_ENDIAN;
 #undef PLATFORM_IS_LITTLE_ENDIAN
 
+	// The lock counts of a mutex named with Mutex::SetProfileName(). Built
+	// with ROCKSDB_MUTEX_CONTENTION_PROFILE, Lock() first tries the lock; an
+	// acquisition that has to wait counts as contended, and the wait is timed.
+	// Uncontended acquisitions cost no more than the try.
+	struct MutexContention {
+		const char* site;
+		int instance;
+		uint64_t acquisitions;
+		uint64_t contended;
+		uint64_t wait_nanos;
+	};
+
+	// Whether this build counts mutex contention.
+	extern const bool kMutexContentionProfile;
+
+	// The counts of every named mutex alive, ordered by site and instance.
+	// Empty unless kMutexContentionProfile.
+	extern std::vector<MutexContention> GetMutexContention();
+
+	// Zeroes the counts of every named mutex.
+	extern void ResetMutexContention();
+
 	class CondVar;
 
 	class Mutex {
@@ -118,12 +142,33 @@ namespace port {
 		// it does NOT verify that mutex is held by a calling thread
 		void AssertHeld();
 
+		// Reports the contention of this mutex in GetMutexContention() under
+		// site, such as "LRUCacheShard::mutex_", and instance, such as the shard
+		// index. site must outlive the mutex. A no-op unless built with
+		// ROCKSDB_MUTEX_CONTENTION_PROFILE.
+#ifdef ROCKSDB_MUTEX_CONTENTION_PROFILE
+		void SetProfileName(const char* site, int instance);
+#else
+		void SetProfileName(const char* /*site*/, int /*instance*/) {}
+#endif
+
 	private:
 		friend class CondVar;
+		friend void ResetMutexContention();
+		friend std::vector<MutexContention> GetMutexContention();
 		pthread_mutex_t mu_;
 #ifndef NDEBUG
 		bool locked_;
 #endif
+#ifdef ROCKSDB_MUTEX_CONTENTION_PROFILE
+		// Updated by the holder of the mutex only, so plain load and store
+		// suffice; atomic so that reports can read them concurrently.
+		std::atomic<uint64_t> acquisitions_;
+		std::atomic<uint64_t> contended_;
+		std::atomic<uint64_t> wait_nanos_;
+		const char* profile_site_;
+		int profile_instance_;
+#endif
 
 		// No copying
 		Mutex(const Mutex&);
@@ -198,6 +243,11 @@ asm volatile("or 27,27,27");
 
 	extern void cacheline_aligned_free(void *memblock);
 
+	// Returns the number of usable bytes of the heap block at p, which was
+	// requested with allocation_size bytes. Falls back to allocation_size
+	// where the allocator cannot tell.
+	extern size_t MallocUsableSize(void* p, size_t allocation_size);
+
 #define ALIGN_AS(n) alignas(n)
 
 #define PREFETCH(addr, rw, locality) __builtin_prefetch(addr, rw, locality)
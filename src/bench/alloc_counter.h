@@ -0,0 +1,20 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stdint.h>
+
+namespace rocksdb {
+
+// Heap allocations made by the calling thread so far, so that a bench can
+// report allocations per operation. Linking alloc_counter.cc replaces every
+// form of the global operators new and delete with counting ones on top of
+// malloc() and free(). They live in their own translation unit so that the
+// compiler does not inline them into callers and mistake the free() for a
+// mismatch with operator new.
+uint64_t ThreadAllocations();
+
+}  // namespace rocksdb
@@ -0,0 +1,61 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace rocksdb {
+
+// A clock cheap enough to time single cache operations: the TSC on x86, the
+// virtual counter on AArch64, steady_clock elsewhere. Ticks are converted to
+// nanoseconds with a rate measured once against steady_clock, so convert
+// when reporting rather than per sample.
+class CycleClock {
+ public:
+  static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  // Nanoseconds per tick of Now(). The first call calibrates for about
+  // 10ms; call it before timing anything.
+  static double NanosPerTick() {
+    static const double nanos_per_tick = Calibrate();
+    return nanos_per_tick;
+  }
+
+ private:
+  static double Calibrate() {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    uint64_t start_ticks = Now();
+    Clock::time_point end;
+    do {
+      end = Clock::now();
+    } while (end - start < std::chrono::milliseconds(10));
+    uint64_t ticks = Now() - start_ticks;
+    double nanos = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+    return ticks > 0 ? nanos / ticks : 1.0;
+  }
+};
+
+}  // namespace rocksdb
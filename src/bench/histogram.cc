@@ -0,0 +1,72 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "histogram.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace rocksdb {
+
+void LatencyHistogram::Clear() {
+  memset(buckets_, 0, sizeof(buckets_));
+  count_ = 0;
+  sum_ = 0;
+  max_ = 0;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (int i = 0; i < kNumBuckets; i++) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  if (other.max_ > max_) {
+    max_ = other.max_;
+  }
+}
+
+uint64_t LatencyHistogram::BucketLimit(int index) {
+  if (index < static_cast<int>(kSubBuckets)) {
+    return static_cast<uint64_t>(index);
+  }
+  int shift = index / static_cast<int>(kSubBuckets) - 1;
+  uint64_t sub = static_cast<uint64_t>(index) % kSubBuckets;
+  return ((kSubBuckets + sub) << shift) + ((uint64_t{1} << shift) - 1);
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  // The rank of the sample, counting from 1.
+  uint64_t rank = static_cast<uint64_t>(p / 100.0 * count_ + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      uint64_t limit = BucketLimit(i);
+      return limit < max_ ? limit : max_;
+    }
+  }
+  return max_;
+}
+
+std::string LatencyHistogram::ToString(double scale) const {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "count %llu avg %.0f p50 %.0f p99 %.0f p99.9 %.0f p99.99 %.0f "
+           "max %.0f",
+           static_cast<unsigned long long>(count_), Average() * scale,
+           Percentile(50) * scale, Percentile(99) * scale,
+           Percentile(99.9) * scale, Percentile(99.99) * scale,
+           max_ * scale);
+  return buf;
+}
+
+}  // namespace rocksdb
@@ -0,0 +1,74 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace rocksdb {
+
+// A log-linear histogram in the style of HdrHistogram: values below
+// kSubBuckets are counted exactly, and every power of two above is split
+// into kSubBuckets linear buckets, so any value is known to within about
+// 3%. Adding a sample is a count-leading-zeros and an increment.
+//
+// Not thread-safe; keep one per thread and Merge() them at the end.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() { Clear(); }
+
+  void Clear();
+
+  void Add(uint64_t value) {
+    buckets_[BucketIndex(value)]++;
+    count_++;
+    sum_ += value;
+    if (value > max_) {
+      max_ = value;
+    }
+  }
+
+  void Merge(const LatencyHistogram& other);
+
+  uint64_t Count() const { return count_; }
+  uint64_t Max() const { return max_; }
+  double Average() const {
+    return count_ == 0 ? 0 : static_cast<double>(sum_) / count_;
+  }
+
+  // The value below which p percent of the samples fall, as the upper end
+  // of the bucket holding that sample, capped at Max().
+  uint64_t Percentile(double p) const;
+
+  // "count N avg A p50 A p99 A p99.9 A p99.99 A max A", with every value
+  // multiplied by scale, e.g. to turn clock ticks into nanoseconds.
+  std::string ToString(double scale) const;
+
+ private:
+  static const int kSubBucketBits = 5;
+  static const uint64_t kSubBuckets = 1 << kSubBucketBits;
+  static const int kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  static int BucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+      return static_cast<int>(value);
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - kSubBucketBits;
+    return (shift + 1) * static_cast<int>(kSubBuckets) +
+           static_cast<int>((value >> shift) - kSubBuckets);
+  }
+
+  // The largest value that falls in bucket index.
+  static uint64_t BucketLimit(int index);
+
+  uint64_t buckets_[kNumBuckets];
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+}  // namespace rocksdb
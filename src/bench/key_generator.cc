@@ -0,0 +1,100 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "key_generator.h"
+
+#include <math.h>
+
+namespace rocksdb {
+
+bool KeyGenerator::ParseDistribution(const std::string& name,
+                                     Distribution* dist) {
+  if (name == "uniform") {
+    *dist = kUniform;
+  } else if (name == "zipf") {
+    *dist = kZipf;
+  } else if (name == "scrambled_zipf") {
+    *dist = kScrambledZipf;
+  } else if (name == "hotspot") {
+    *dist = kHotspot;
+  } else if (name == "latest") {
+    *dist = kLatest;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+KeyGenerator::KeyGenerator(Distribution dist, uint64_t max_key, double theta,
+                           double hot_set_fraction, double hot_op_fraction)
+    : dist_(dist),
+      max_key_(max_key),
+      theta_(theta),
+      hot_keys_(static_cast<uint64_t>(max_key * hot_set_fraction)),
+      hot_op_fraction_(hot_op_fraction),
+      alpha_(0),
+      zetan_(0),
+      eta_(0),
+      latest_(0) {
+  if (dist_ == kZipf || dist_ == kScrambledZipf || dist_ == kLatest) {
+    alpha_ = 1.0 / (1.0 - theta_);
+    zetan_ = Zeta(max_key_, theta_);
+    double zeta2 = Zeta(2, theta_);
+    eta_ = (1.0 - pow(2.0 / max_key_, 1.0 - theta_)) / (1.0 - zeta2 / zetan_);
+  }
+}
+
+double KeyGenerator::Zeta(uint64_t n, double theta) {
+  const uint64_t kExactTerms = 1 << 20;
+  double sum = 0;
+  uint64_t exact = n < kExactTerms ? n : kExactTerms;
+  for (uint64_t i = 1; i <= exact; i++) {
+    sum += pow(static_cast<double>(i), -theta);
+  }
+  if (n > exact) {
+    // Integral of x^-theta over [exact + 0.5, n + 0.5], which tracks the
+    // sum of the remaining terms closely since they change slowly.
+    double lo = exact + 0.5;
+    double hi = n + 0.5;
+    sum += (pow(hi, 1.0 - theta) - pow(lo, 1.0 - theta)) / (1.0 - theta);
+  }
+  return sum;
+}
+
+uint64_t KeyGenerator::NextZipf(Random* rnd) const {
+  double u = NextDouble(rnd);
+  double uz = u * zetan_;
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < 1.0 + pow(0.5, theta_)) {
+    return 1;
+  }
+  uint64_t rank =
+      static_cast<uint64_t>(max_key_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+  return rank < max_key_ ? rank : max_key_ - 1;
+}
+
+uint64_t KeyGenerator::NextHotspot(Random* rnd) const {
+  if (hot_keys_ == 0 || hot_keys_ >= max_key_) {
+    return rnd->Next() % max_key_;
+  }
+  if (NextDouble(rnd) < hot_op_fraction_) {
+    return rnd->Next() % hot_keys_;
+  }
+  return hot_keys_ + rnd->Next() % (max_key_ - hot_keys_);
+}
+
+uint64_t KeyGenerator::NextLatest(Random* rnd) const {
+  uint64_t latest = latest_.load(std::memory_order_relaxed);
+  uint64_t back = NextZipf(rnd);
+  if (latest == 0) {
+    // Nothing inserted yet.
+    return back;
+  }
+  return (latest - 1 + max_key_ - back) % max_key_;
+}
+
+}  // namespace rocksdb
@@ -0,0 +1,120 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "random.h"
+
+namespace rocksdb {
+
+// Draws cache_bench keys in [0, max_key) from a configurable distribution.
+// One generator is shared by all bench threads; each thread passes its own
+// Random.
+//
+// - uniform: every key equally likely.
+// - zipf: key k has probability proportional to 1 / (k + 1)^theta, so key 0
+//   is the hottest.
+// - scrambled_zipf: zipf, with ranks hashed over the key space so the hot
+//   keys are not adjacent.
+// - hotspot: hot_op_fraction of the draws hit the first hot_set_fraction of
+//   the key space, uniformly; the rest are uniform over the remainder.
+// - latest: inserts take fresh sequential keys and the other ops pick the
+//   recently inserted ones, zipf by recency, as in YCSB workload D.
+class KeyGenerator {
+ public:
+  enum Distribution {
+    kUniform,
+    kZipf,
+    kScrambledZipf,
+    kHotspot,
+    kLatest,
+  };
+
+  // Returns false if name is not one of the distributions above.
+  static bool ParseDistribution(const std::string& name, Distribution* dist);
+
+  // theta is the zipf skew and must be in (0, 1); it is ignored by uniform
+  // and hotspot.
+  KeyGenerator(Distribution dist, uint64_t max_key, double theta,
+               double hot_set_fraction, double hot_op_fraction);
+
+  // The key for a lookup or erase.
+  uint64_t Next(Random* rnd) {
+    switch (dist_) {
+      case kUniform:
+        return rnd->Next() % max_key_;
+      case kZipf:
+        return NextZipf(rnd);
+      case kScrambledZipf:
+        return Scramble(NextZipf(rnd)) % max_key_;
+      case kHotspot:
+        return NextHotspot(rnd);
+      case kLatest:
+        return NextLatest(rnd);
+    }
+    return 0;
+  }
+
+  // The key for an insert, given key drawn by Next(). Only kLatest inserts
+  // a different key: the next sequential one.
+  uint64_t InsertKey(uint64_t key) {
+    if (dist_ == kLatest) {
+      return latest_.fetch_add(1, std::memory_order_relaxed) % max_key_;
+    }
+    return key;
+  }
+
+  // The state InsertKey() advances, so that a bench can draw the same keys
+  // again from the same point.
+  uint64_t SaveState() const { return latest_.load(std::memory_order_relaxed); }
+  void RestoreState(uint64_t state) {
+    latest_.store(state, std::memory_order_relaxed);
+  }
+
+ private:
+  // Uniform in [0, 1), from the 31 bits Random::Next() returns.
+  static double NextDouble(Random* rnd) {
+    return rnd->Next() * (1.0 / 2147483648.0);
+  }
+
+  static uint64_t Scramble(uint64_t x) {
+    // The finalizer of MurmurHash3.
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+  }
+
+  // A rank in [0, max_key_) by the method of Gray et al., "Quickly
+  // Generating Billion-Record Synthetic Databases": one pow() per draw,
+  // against constants computed once by the constructor.
+  uint64_t NextZipf(Random* rnd) const;
+  uint64_t NextHotspot(Random* rnd) const;
+  uint64_t NextLatest(Random* rnd) const;
+
+  // sum_{i=1..n} 1 / i^theta. Exact for the first terms, then by the
+  // integral of the tail, so it stays cheap for billions of keys.
+  static double Zeta(uint64_t n, double theta);
+
+  const Distribution dist_;
+  const uint64_t max_key_;
+  const double theta_;
+  const uint64_t hot_keys_;
+  const double hot_op_fraction_;
+  // Zipf constants.
+  double alpha_;
+  double zetan_;
+  double eta_;
+  // The number of keys inserted through InsertKey() under kLatest.
+  std::atomic<uint64_t> latest_;
+};
+
+}  // namespace rocksdb
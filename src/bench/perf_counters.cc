@@ -0,0 +1,137 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace rocksdb {
+
+namespace {
+
+const char* const kCounterNames[PerfCounters::kNumCounters] = {
+    "cycles",       "instructions",  "llc_misses",
+    "dtlb_misses",  "branch_misses", "context_switches",
+};
+
+#ifdef __linux__
+struct CounterConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+const CounterConfig kCounterConfigs[PerfCounters::kNumCounters] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+#endif
+
+}  // namespace
+
+const char* PerfCounters::Name(int counter) { return kCounterNames[counter]; }
+
+PerfCounters::PerfCounters() {
+  for (int i = 0; i < kNumCounters; i++) {
+    fds_[i] = -1;
+    values_[i] = 0;
+  }
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  for (int i = 0; i < kNumCounters; i++) {
+    if (fds_[i] >= 0) {
+      close(fds_[i]);
+    }
+  }
+#endif
+}
+
+bool PerfCounters::Open(std::string* error) {
+#ifdef __linux__
+  bool any = false;
+  for (int i = 0; i < kNumCounters; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = kCounterConfigs[i].type;
+    attr.config = kCounterConfigs[i].config;
+    attr.disabled = 1;
+    // User space only, which unprivileged processes may count at the
+    // default perf_event_paranoid level. Not for context switches, which
+    // happen in the kernel.
+    if (attr.type != PERF_TYPE_SOFTWARE) {
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+    }
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int fd = static_cast<int>(
+        syscall(__NR_perf_event_open, &attr, 0 /* this thread */,
+                -1 /* any cpu */, -1 /* no group */, 0));
+    if (fd < 0) {
+      if (error->empty()) {
+        *error = std::string(kCounterNames[i]) + ": " + strerror(errno);
+      }
+      continue;
+    }
+    fds_[i] = fd;
+    any = true;
+  }
+  return any;
+#else
+  *error = "perf_event_open is Linux only";
+  return false;
+#endif
+}
+
+void PerfCounters::Start() {
+#ifdef __linux__
+  for (int i = 0; i < kNumCounters; i++) {
+    if (fds_[i] >= 0) {
+      ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+}
+
+void PerfCounters::Stop() {
+#ifdef __linux__
+  for (int i = 0; i < kNumCounters; i++) {
+    if (fds_[i] < 0) {
+      continue;
+    }
+    ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+    // value, time enabled, time running
+    uint64_t data[3];
+    if (read(fds_[i], data, sizeof(data)) != sizeof(data)) {
+      continue;
+    }
+    uint64_t value = data[0];
+    if (data[2] > 0 && data[2] < data[1]) {
+      value = static_cast<uint64_t>(static_cast<double>(value) * data[1] /
+                                    data[2]);
+    }
+    values_[i] += value;
+  }
+#endif
+}
+
+}  // namespace rocksdb
@@ -0,0 +1,61 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace rocksdb {
+
+// Hardware and software event counts of the calling thread, from
+// perf_event_open(2), so that a bench can report cache and TLB misses per op
+// next to its throughput.
+//
+// Each counter is opened on its own, so the ones the kernel, the CPU or a
+// container does not allow are skipped and the rest still count; check
+// Available(). Counts are scaled up if the kernel had to multiplex the
+// hardware counters. Outside Linux no counter is available.
+class PerfCounters {
+ public:
+  enum Counter {
+    kCycles,
+    kInstructions,
+    kLLCMisses,
+    kDTLBMisses,
+    kBranchMisses,
+    kContextSwitches,
+    kNumCounters,
+  };
+
+  // "cycles", "instructions", "llc_misses", ...
+  static const char* Name(int counter);
+
+  PerfCounters();
+  ~PerfCounters();
+
+  // Opens the counters for the calling thread, stopped. Returns false if
+  // none could be opened, with the reason for the first failure in *error.
+  bool Open(std::string* error);
+
+  // Start() and Stop() must be called on the thread that called Open().
+  // They may alternate any number of times; Value() sums the intervals.
+  void Start();
+  // Adds the counts since Start() to Value().
+  void Stop();
+
+  bool Available(int counter) const { return fds_[counter] >= 0; }
+  uint64_t Value(int counter) const { return values_[counter]; }
+
+ private:
+  int fds_[kNumCounters];
+  uint64_t values_[kNumCounters];
+
+  // No copying allowed
+  PerfCounters(const PerfCounters&);
+  void operator=(const PerfCounters&);
+};
+
+}  // namespace rocksdb
@@ -0,0 +1,78 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "value_size_generator.h"
+
+#include <math.h>
+
+namespace rocksdb {
+
+bool ValueSizeGenerator::ParseDistribution(const std::string& name,
+                                           Distribution* dist) {
+  if (name == "fixed") {
+    *dist = kFixed;
+  } else if (name == "uniform") {
+    *dist = kUniform;
+  } else if (name == "lognormal") {
+    *dist = kLognormal;
+  } else if (name == "bimodal") {
+    *dist = kBimodal;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+ValueSizeGenerator::ValueSizeGenerator(Distribution dist, size_t mean,
+                                       double sigma, double large_fraction,
+                                       double large_ratio)
+    : dist_(dist),
+      mean_(mean),
+      sigma_(sigma),
+      large_fraction_(large_fraction),
+      mu_(0),
+      small_(mean),
+      large_(mean) {
+  if (dist_ == kLognormal) {
+    // The mean of exp(N(mu, sigma)) is exp(mu + sigma^2 / 2).
+    mu_ = log(static_cast<double>(mean_)) - sigma_ * sigma_ / 2;
+  } else if (dist_ == kBimodal) {
+    double small =
+        mean_ / (1 - large_fraction_ + large_fraction_ * large_ratio);
+    small_ = small < 1 ? 1 : static_cast<size_t>(small + 0.5);
+    large_ = static_cast<size_t>(small * large_ratio + 0.5);
+  }
+}
+
+size_t ValueSizeGenerator::Next(Random* rnd) const {
+  double size = static_cast<double>(mean_);
+  switch (dist_) {
+    case kFixed:
+      break;
+    case kUniform:
+      size = 1 + rnd->Next() % (2 * mean_ - 1);
+      break;
+    case kLognormal: {
+      // Box-Muller.
+      double normal = sqrt(-2 * log(NextDouble(rnd))) *
+                      cos(2 * M_PI * NextDouble(rnd));
+      size = exp(mu_ + sigma_ * normal);
+      break;
+    }
+    case kBimodal:
+      size = static_cast<double>(NextDouble(rnd) <= large_fraction_ ? large_
+                                                                    : small_);
+      break;
+  }
+  if (size < 1) {
+    return 1;
+  }
+  if (size > kMaxValueSize) {
+    return kMaxValueSize;
+  }
+  return static_cast<size_t>(size);
+}
+
+}  // namespace rocksdb
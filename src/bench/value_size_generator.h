@@ -0,0 +1,66 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "random.h"
+
+namespace rocksdb {
+
+// Draws cache_bench value sizes, in bytes, with a given mean. Like
+// KeyGenerator, one generator is shared by all bench threads and each
+// thread passes its own Random.
+//
+// - fixed: always the mean.
+// - uniform: uniform in [1, 2 * mean - 1].
+// - lognormal: exp(N(mu, sigma)), with mu set so the mean comes out right;
+//   a long tail of large values, as block and object sizes tend to have.
+// - bimodal: large_fraction of the values are large_ratio times the size of
+//   the rest, e.g. small index entries mixed with large blobs.
+//
+// Sizes are at least 1 and at most kMaxValueSize.
+class ValueSizeGenerator {
+ public:
+  enum Distribution {
+    kFixed,
+    kUniform,
+    kLognormal,
+    kBimodal,
+  };
+
+  static const size_t kMaxValueSize = 64 << 20;
+
+  // Returns false if name is not one of the distributions above.
+  static bool ParseDistribution(const std::string& name, Distribution* dist);
+
+  // mean must be > 0. sigma is only used by lognormal, large_fraction and
+  // large_ratio only by bimodal.
+  ValueSizeGenerator(Distribution dist, size_t mean, double sigma,
+                     double large_fraction, double large_ratio);
+
+  size_t Next(Random* rnd) const;
+
+ private:
+  // Uniform in (0, 1], from the 31 bits Random::Next() returns.
+  static double NextDouble(Random* rnd) {
+    return (rnd->Next() + 1.0) * (1.0 / 2147483648.0);
+  }
+
+  const Distribution dist_;
+  const size_t mean_;
+  const double sigma_;
+  const double large_fraction_;
+  // lognormal: the mean of the underlying normal.
+  double mu_;
+  // bimodal: the two sizes.
+  size_t small_;
+  size_t large_;
+};
+
+}  // namespace rocksdb
@@ -0,0 +1,82 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "async_deleter.h"
+
+void AsyncDeleter::Batch::Run() {
+  for (const Entry& entry : entries_) {
+    if (entry.deleter != nullptr) {
+      (*entry.deleter)(entry.key, entry.value);
+    }
+    if (entry.arena != nullptr) {
+      entry.arena->Deallocate(entry.buf, entry.buf_size);
+    } else {
+      delete[] entry.buf;
+    }
+  }
+}
+
+AsyncDeleter::AsyncDeleter(int num_threads, size_t max_pending_charge)
+    : head_(nullptr),
+      pending_charge_(0),
+      max_pending_charge_(max_pending_charge),
+      shut_down_(false),
+      thread_pool_(NewThreadPool(num_threads)) {}
+
+AsyncDeleter::~AsyncDeleter() { Shutdown(); }
+
+void AsyncDeleter::Shutdown() {
+  if (shut_down_.exchange(true, std::memory_order_acq_rel)) {
+    return;
+  }
+  thread_pool_->WaitForJobsAndJoinAllThreads();
+  Drain();
+}
+
+void AsyncDeleter::Submit(Batch* batch) {
+  if (shut_down_.load(std::memory_order_acquire)) {
+    batch->Run();
+    delete batch;
+    return;
+  }
+  size_t charge = batch->charge();
+  // Reserve the charge with a CAS, so that concurrent submitters cannot
+  // all pass the check and overshoot the bound together.
+  size_t pending = pending_charge_.load(std::memory_order_relaxed);
+  do {
+    if (pending + charge >
+        max_pending_charge_.load(std::memory_order_relaxed)) {
+      // The workers are falling behind. Delete on this thread instead of
+      // letting the backlog grow.
+      batch->Run();
+      delete batch;
+      Drain();
+      return;
+    }
+  } while (!pending_charge_.compare_exchange_weak(
+      pending, pending + charge, std::memory_order_relaxed));
+  Batch* old_head = head_.load(std::memory_order_relaxed);
+  do {
+    batch->next_ = old_head;
+  } while (!head_.compare_exchange_weak(old_head, batch,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+  // Only the push that makes the stack non-empty schedules a drain; any
+  // later push is picked up by that drain or triggers the next one.
+  if (old_head == nullptr) {
+    thread_pool_->SubmitJob([this]() { Drain(); });
+  }
+}
+
+void AsyncDeleter::Drain() {
+  Batch* batch = head_.exchange(nullptr, std::memory_order_acquire);
+  while (batch != nullptr) {
+    Batch* next = batch->next_;
+    batch->Run();
+    pending_charge_.fetch_sub(batch->charge(), std::memory_order_relaxed);
+    delete batch;
+    batch = next;
+  }
+}
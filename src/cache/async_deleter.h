@@ -0,0 +1,100 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "huge_page_arena.h"
+#include "slice.h"
+#include "threadpool.h"
+
+// AsyncDeleter moves the user deleters of evicted or erased cache entries off
+// the thread that dropped the last reference. Shards hand over a batch of
+// entries once they have released their mutex; batches are pushed onto a
+// lock-free stack and drained by ThreadPool workers.
+//
+// Back-pressure: the total charge of entries waiting for a worker is bounded
+// by max_pending_charge. A caller that would exceed the bound runs its own
+// batch inline and helps drain the queue, so the memory held by not yet
+// deleted values stays proportional to the cache capacity.
+class AsyncDeleter {
+ public:
+  struct Entry {
+    void (*deleter)(const Slice& key, void* value);
+    Slice key;
+    void* value;
+    // Freed after the deleter ran. Owns the key bytes.
+    char* buf;
+    // If set, buf of buf_size bytes goes back to this arena instead of
+    // being freed with delete[].
+    HugePageArena* arena;
+    size_t buf_size;
+  };
+
+  class Batch {
+   public:
+    Batch() : charge_(0), next_(nullptr) {}
+
+    void Add(void (*deleter)(const Slice& key, void* value), const Slice& key,
+             void* value, size_t charge, char* buf,
+             HugePageArena* arena = nullptr, size_t buf_size = 0) {
+      entries_.push_back(Entry{deleter, key, value, buf, arena, buf_size});
+      charge_ += charge;
+    }
+
+    bool empty() const { return entries_.empty(); }
+    size_t charge() const { return charge_; }
+
+   private:
+    friend class AsyncDeleter;
+
+    void Run();
+
+    std::vector<Entry> entries_;
+    size_t charge_;
+    Batch* next_;
+  };
+
+  AsyncDeleter(int num_threads, size_t max_pending_charge);
+
+  // Calls Shutdown() unless the owner already did.
+  ~AsyncDeleter();
+
+  // Waits for the workers, joins them and runs whatever is still queued.
+  // Batches submitted afterwards run on the calling thread. The owning
+  // cache calls this before destroying its shards, since queued batches may
+  // hand buffers back to a shard's HugePageArena.
+  void Shutdown();
+
+  // Takes ownership of batch. The deleters run on a worker unless the queue
+  // is over its bound or the deleter is shut down, in which case they run on
+  // the calling thread.
+  void Submit(Batch* batch);
+
+  void SetMaxPendingCharge(size_t max_pending_charge) {
+    max_pending_charge_.store(max_pending_charge, std::memory_order_relaxed);
+  }
+
+  size_t GetPendingCharge() const {
+    return pending_charge_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Pop every queued batch and run it on the calling thread.
+  void Drain();
+
+  std::atomic<Batch*> head_;
+  std::atomic<size_t> pending_charge_;
+  std::atomic<size_t> max_pending_charge_;
+  std::atomic<bool> shut_down_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  // No copying allowed
+  AsyncDeleter(const AsyncDeleter&);
+  void operator=(const AsyncDeleter&);
+};
@@ -0,0 +1,56 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "async_lookup.h"
+
+#include <exception>
+#include <string>
+
+namespace {
+
+// A miss waiting for a thread pool worker. Owns copies of everything the
+// caller passed, since the caller does not wait for the load.
+struct LoadJob {
+  std::shared_ptr<Cache> cache;
+  std::string key;
+  Cache::CreateCallback loader;
+  void (*deleter)(const Slice& key, void* value);
+  std::promise<Cache::Handle*> promise;
+
+  static void Run(void* arg) {
+    std::unique_ptr<LoadJob> job(reinterpret_cast<LoadJob*>(arg));
+    // A throwing loader must not unwind into the pool thread, which would
+    // terminate the process; the caller gets the exception from the future.
+    try {
+      job->promise.set_value(
+          job->cache->GetOrCreate(job->key, job->loader, job->deleter));
+    } catch (...) {
+      job->promise.set_exception(std::current_exception());
+    }
+  }
+};
+
+}  // namespace
+
+std::future<Cache::Handle*> LookupAsync(
+    const std::shared_ptr<Cache>& cache, const Slice& key,
+    const Cache::CreateCallback& loader,
+    void (*deleter)(const Slice& key, void* value), Env::Priority pri,
+    Env* env) {
+  Cache::Handle* handle = cache->Lookup(key);
+  if (handle != nullptr) {
+    std::promise<Cache::Handle*> hit;
+    hit.set_value(handle);
+    return hit.get_future();
+  }
+  LoadJob* job = new LoadJob();
+  job->cache = cache;
+  job->key = key.ToString();
+  job->loader = loader;
+  job->deleter = deleter;
+  std::future<Cache::Handle*> result = job->promise.get_future();
+  env->Schedule(&LoadJob::Run, job, pri);
+  return result;
+}
@@ -0,0 +1,31 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <future>
+#include <memory>
+
+#include "cache.h"
+#include "env.h"
+
+// Look key up in cache without blocking the caller on a miss.
+//
+// A hit completes the returned future right away. A miss is handed to
+// env's thread pool at priority pri, where cache->GetOrCreate() runs loader
+// and inserts its value, so concurrent misses on the same key share one
+// load. A request thread can issue all of its misses first and then wait
+// on the futures together, overlapping slow loads with each other and with
+// its own work.
+//
+// The future yields the handle, which the caller must Release(), or
+// nullptr if loader failed or the value could not be inserted. If loader
+// threw, the future's get() rethrows its exception. The cache is kept
+// alive until the load finishes.
+extern std::future<Cache::Handle*> LookupAsync(
+    const std::shared_ptr<Cache>& cache, const Slice& key,
+    const Cache::CreateCallback& loader,
+    void (*deleter)(const Slice& key, void* value),
+    Env::Priority pri = Env::LOW, Env* env = Env::Default());
@@ -0,0 +1,162 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A vector that keeps the first kSize elements in place and only spills to
+// the heap after that. clear() destroys the elements but keeps the spilled
+// capacity, so an autovector that is reused across calls stops allocating
+// once it has seen its largest working set.
+//
+// Only the operations the cache needs are supported: append, random access,
+// iteration and clear.
+template <class T, size_t kSize = 8>
+class autovector {
+ public:
+  class const_iterator {
+   public:
+    const_iterator(const autovector* vect, size_t index)
+        : vect_(vect), index_(index) {}
+    const T& operator*() const { return (*vect_)[index_]; }
+    const T* operator->() const { return &(*vect_)[index_]; }
+    const_iterator& operator++() {
+      ++index_;
+      return *this;
+    }
+    bool operator==(const const_iterator& other) const {
+      return vect_ == other.vect_ && index_ == other.index_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    const autovector* vect_;
+    size_t index_;
+  };
+
+  autovector() : num_stack_items_(0) {}
+  ~autovector() { clear(); }
+
+  size_t size() const { return num_stack_items_ + vect_.size(); }
+  bool empty() const { return size() == 0; }
+
+  const T& operator[](size_t n) const {
+    assert(n < size());
+    return n < kSize ? *stack_item(n) : vect_[n - kSize];
+  }
+  T& operator[](size_t n) {
+    assert(n < size());
+    return n < kSize ? *stack_item(n) : vect_[n - kSize];
+  }
+
+  void push_back(const T& item) { emplace_back(item); }
+
+  template <class... Args>
+  void emplace_back(Args&&... args) {
+    if (num_stack_items_ < kSize) {
+      new (&buf_[num_stack_items_]) T(std::forward<Args>(args)...);
+      ++num_stack_items_;
+    } else {
+      vect_.emplace_back(std::forward<Args>(args)...);
+    }
+  }
+
+  void clear() {
+    for (size_t i = 0; i < num_stack_items_; i++) {
+      stack_item(i)->~T();
+    }
+    num_stack_items_ = 0;
+    vect_.clear();
+  }
+
+  // clear(), and also free the spilled storage if it holds more than
+  // max_retained elements, so that one large operation does not pin its
+  // peak for as long as the autovector is reused.
+  void clear_and_trim(size_t max_retained) {
+    clear();
+    if (vect_.capacity() > max_retained) {
+      std::vector<T>().swap(vect_);
+    }
+  }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+ private:
+  T* stack_item(size_t n) { return reinterpret_cast<T*>(&buf_[n]); }
+  const T* stack_item(size_t n) const {
+    return reinterpret_cast<const T*>(&buf_[n]);
+  }
+
+  size_t num_stack_items_;
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type buf_[kSize];
+  std::vector<T> vect_;
+
+  // No copying allowed
+  autovector(const autovector&);
+  void operator=(const autovector&);
+};
+
+// Borrows this thread's instance of T for the lifetime of the scope, so the
+// scratch lists used to defer frees out of the shard mutex are reused across
+// cache operations instead of being rebuilt every call. T must have
+// clear_and_trim(max_retained), like autovector, which is called when the
+// scope ends: the instance keeps up to kMaxRetained spilled elements, and
+// frees more than that instead of holding on to a rare peak.
+//
+// A deleter may call back into the cache while the thread's instance is
+// borrowed; the nested scope then falls back to a private instance.
+template <class T>
+class ScopedThreadLocal {
+ public:
+  ScopedThreadLocal() : ptr_(&local_), borrowed_(false) {
+    Slot& slot = GetSlot();
+    if (!slot.in_use) {
+      slot.in_use = true;
+      ptr_ = &slot.value;
+      borrowed_ = true;
+    }
+  }
+
+  ~ScopedThreadLocal() {
+    ptr_->clear_and_trim(kMaxRetained);
+    if (borrowed_) {
+      GetSlot().in_use = false;
+    }
+  }
+
+  T* get() { return ptr_; }
+  T* operator->() { return ptr_; }
+  T& operator*() { return *ptr_; }
+
+ private:
+  static const size_t kMaxRetained = 256;
+
+  struct Slot {
+    T value;
+    bool in_use = false;
+  };
+
+  static Slot& GetSlot() {
+    static thread_local Slot slot;
+    return slot;
+  }
+
+  T* ptr_;
+  bool borrowed_;
+  T local_;
+
+  // No copying allowed
+  ScopedThreadLocal(const ScopedThreadLocal&);
+  void operator=(const ScopedThreadLocal&);
+};
@@ -0,0 +1,54 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "cache_reservation_manager.h"
+
+#include <assert.h>
+
+#include "sharded_cache.h"
+
+CacheReservationManager::CacheReservationManager(std::shared_ptr<Cache> cache)
+    : cache_(std::move(cache)),
+      seed_(cache_->NewId()),
+      num_units_(0),
+      memory_used_(0) {}
+
+CacheReservationManager::~CacheReservationManager() {
+  for (size_t unit = num_units_; unit > 0; unit--) {
+    cache_->Unreserve(UnitHash(unit - 1), kUnitSize);
+  }
+}
+
+bool CacheReservationManager::UpdateCacheReservation(size_t new_memory_used) {
+  MutexLock l(&mutex_);
+  memory_used_ = new_memory_used;
+  size_t target = (new_memory_used + kUnitSize - 1) / kUnitSize;
+  if (target < num_units_ && target > num_units_ * 3 / 4) {
+    return true;
+  }
+  // Units are released in the reverse order they were taken, so unit i
+  // always lives on the shard UnitHash(i) maps to.
+  while (num_units_ > target) {
+    num_units_--;
+    cache_->Unreserve(UnitHash(num_units_), kUnitSize);
+  }
+  while (num_units_ < target) {
+    if (!cache_->Reserve(UnitHash(num_units_), kUnitSize)) {
+      return false;
+    }
+    num_units_++;
+  }
+  return true;
+}
+
+size_t CacheReservationManager::GetTotalReservedCacheSize() const {
+  MutexLock l(&mutex_);
+  return num_units_ * kUnitSize;
+}
+
+size_t CacheReservationManager::GetTotalMemoryUsed() const {
+  MutexLock l(&mutex_);
+  return memory_used_;
+}
@@ -0,0 +1,348 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "cache_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sharded_cache.h"
+
+namespace {
+
+const char kTraceMagic[8] = {'C', 'A', 'C', 'H', 'E', 'T', 'R', 'C'};
+const uint32_t kTraceVersion = 1;
+const size_t kFileHeaderSize = 24;
+const size_t kChunkHeaderSize = 8;
+// Traced thread ids count up from 0, one per thread that traced. A chunk
+// claiming a larger one is corrupt, and would size the index by it.
+const uint32_t kMaxTraceThreads = 1 << 16;
+
+std::atomic<uint64_t> next_tracer_id(1);
+
+}  // namespace
+
+TracingCache::TracingCache(std::shared_ptr<Cache> target, FILE* file)
+    : target_(std::move(target)),
+      id_(next_tracer_id.fetch_add(1, std::memory_order_relaxed)),
+      start_(std::chrono::steady_clock::now()),
+      tracing_(true),
+      cv_(&mutex_),
+      pending_bytes_(0),
+      closing_(false),
+      file_(file),
+      write_ok_(true) {
+  writer_ = port::Thread(&TracingCache::WriterLoop, this);
+}
+
+TracingCache::~TracingCache() { EndTrace(); }
+
+bool TracingCache::EndTrace() {
+  if (!tracing_.exchange(false)) {
+    return write_ok_;
+  }
+  {
+    MutexLock l(&mutex_);
+    // Behind the chunks the threads handed over already, so each thread's
+    // records stay in order.
+    for (auto& entry : buffers_) {
+      ThreadBuffer* buffer = entry.second.get();
+      if (!buffer->records.empty()) {
+        pending_bytes_ += buffer->records.size();
+        pending_.push_back(Chunk{buffer->thread, std::move(buffer->records)});
+        buffer->records.clear();
+      }
+    }
+    closing_ = true;
+    cv_.SignalAll();
+  }
+  writer_.join();
+  if (fclose(file_) != 0) {
+    write_ok_ = false;
+  }
+  file_ = nullptr;
+  return write_ok_;
+}
+
+bool TracingCache::Insert(const HashedKey& key, void* value, size_t charge,
+                          void (*deleter)(const Slice& key, void* value),
+                          Handle** handle, Priority priority) {
+  Append(kTraceInsert, key, charge, priority);
+  return target_->Insert(key, value, charge, deleter, handle, priority);
+}
+
+void TracingCache::MultiInsert(const Slice* keys, void* const* values,
+                               const size_t* charges, size_t n,
+                               void (*deleter)(const Slice& key, void* value),
+                               Priority priority) {
+  for (size_t i = 0; i < n; i++) {
+    Append(kTraceInsert, HashedKey(keys[i]), charges[i], priority);
+  }
+  target_->MultiInsert(keys, values, charges, n, deleter, priority);
+}
+
+Cache::Handle* TracingCache::Lookup(const HashedKey& key) {
+  Append(kTraceLookup, key, 0, Priority::LOW);
+  return target_->Lookup(key);
+}
+
+void TracingCache::MultiLookup(const Slice* keys, size_t n,
+                               Handle** handles) {
+  for (size_t i = 0; i < n; i++) {
+    Append(kTraceLookup, HashedKey(keys[i]), 0, Priority::LOW);
+  }
+  target_->MultiLookup(keys, n, handles);
+}
+
+bool TracingCache::Get(const Slice& key, const ReadCallback& reader) {
+  Append(kTraceLookup, HashedKey(key), 0, Priority::LOW);
+  return target_->Get(key, reader);
+}
+
+Cache::Handle* TracingCache::GetOrCreate(
+    const Slice& key, const CreateCallback& create,
+    void (*deleter)(const Slice& key, void* value), Priority priority) {
+  HashedKey hashed(key);
+  Append(kTraceLookup, hashed, 0, Priority::LOW);
+  // Captured through one pointer so the std::function does not allocate.
+  struct Created {
+    const CreateCallback* create;
+    bool created;
+    size_t charge;
+  } created = {&create, false, 0};
+  Created* c = &created;
+  Handle* handle = target_->GetOrCreate(
+      key,
+      [c](const Slice& k, size_t* charge) -> void* {
+        void* value = (*c->create)(k, charge);
+        if (value != nullptr) {
+          c->created = true;
+          c->charge = *charge;
+        }
+        return value;
+      },
+      deleter, priority);
+  if (created.created) {
+    Append(kTraceInsert, hashed, created.charge, priority);
+  }
+  return handle;
+}
+
+void TracingCache::Erase(const HashedKey& key) {
+  Append(kTraceErase, key, 0, Priority::LOW);
+  target_->Erase(key);
+}
+
+void TracingCache::Append(CacheTraceOp op, const HashedKey& key,
+                          size_t charge, Priority priority) {
+  if (!tracing_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  CacheTraceRecord record;
+  record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start_)
+                         .count();
+  record.charge = charge;
+  record.hash = key.hash;
+  record.op = op;
+  record.priority = priority;
+  record.key = key.key;
+
+  ThreadBuffer* buffer = GetThreadBuffer();
+  record.EncodeTo(&buffer->records);
+  if (buffer->records.size() >= kChunkSize) {
+    Submit(buffer);
+  }
+}
+
+TracingCache::ThreadBuffer* TracingCache::GetThreadBuffer() {
+  // The buffer of the TracingCache this thread traced to last. Tracer ids
+  // are never reused, so a stale entry is never mistaken for a live one.
+  struct LocalBuffer {
+    uint64_t tracer_id;
+    ThreadBuffer* buffer;
+  };
+  static thread_local LocalBuffer local = {0, nullptr};
+  if (local.tracer_id == id_) {
+    return local.buffer;
+  }
+  MutexLock l(&mutex_);
+  std::unique_ptr<ThreadBuffer>& buffer = buffers_[std::this_thread::get_id()];
+  if (!buffer) {
+    buffer.reset(new ThreadBuffer());
+    buffer->thread = static_cast<uint32_t>(buffers_.size() - 1);
+    buffer->records.reserve(kChunkSize);
+  }
+  local.tracer_id = id_;
+  local.buffer = buffer.get();
+  return buffer.get();
+}
+
+void TracingCache::Submit(ThreadBuffer* buffer) {
+  size_t size = buffer->records.size();
+  {
+    MutexLock l(&mutex_);
+    while (pending_bytes_ >= kMaxPendingBytes && !closing_) {
+      cv_.Wait();
+    }
+    pending_bytes_ += size;
+    pending_.push_back(Chunk{buffer->thread, std::move(buffer->records)});
+    cv_.SignalAll();
+  }
+  buffer->records = std::string();
+  buffer->records.reserve(kChunkSize);
+}
+
+bool TracingCache::WriteChunk(const Chunk& chunk) {
+  char header[kChunkHeaderSize];
+  uint32_t size = static_cast<uint32_t>(chunk.records.size());
+  memcpy(header, &chunk.thread, 4);
+  memcpy(header + 4, &size, 4);
+  return fwrite(header, 1, sizeof(header), file_) == sizeof(header) &&
+         fwrite(chunk.records.data(), 1, size, file_) == size;
+}
+
+void TracingCache::WriterLoop() {
+  mutex_.Lock();
+  while (true) {
+    while (pending_.empty() && !closing_) {
+      cv_.Wait();
+    }
+    if (pending_.empty()) {
+      break;
+    }
+    Chunk chunk = std::move(pending_.front());
+    pending_.pop_front();
+    mutex_.Unlock();
+    bool ok = WriteChunk(chunk);
+    mutex_.Lock();
+    write_ok_ = write_ok_ && ok;
+    pending_bytes_ -= chunk.records.size();
+    cv_.SignalAll();
+  }
+  mutex_.Unlock();
+}
+
+std::shared_ptr<TracingCache> NewTracingCache(std::shared_ptr<Cache> target,
+                                              const std::string& trace_file) {
+  FILE* file = fopen(trace_file.c_str(), "wb");
+  if (file == nullptr) {
+    return nullptr;
+  }
+  char header[kFileHeaderSize];
+  uint64_t start_micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::system_clock::now().time_since_epoch())
+                              .count();
+  uint32_t unused = 0;
+  memcpy(header, kTraceMagic, 8);
+  memcpy(header + 8, &kTraceVersion, 4);
+  memcpy(header + 12, &unused, 4);
+  memcpy(header + 16, &start_micros, 8);
+  if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+    fclose(file);
+    return nullptr;
+  }
+  return std::make_shared<TracingCache>(std::move(target), file);
+}
+
+CacheTraceReader::~CacheTraceReader() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+
+bool CacheTraceReader::Open(const std::string& trace_file,
+                            std::string* error) {
+  int fd = open(trace_file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error = trace_file + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    *error = trace_file + ": " + strerror(errno);
+    close(fd);
+    return false;
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  if (size < kFileHeaderSize) {
+    *error = trace_file + ": not a cache trace";
+    close(fd);
+    return false;
+  }
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    *error = trace_file + ": " + strerror(errno);
+    return false;
+  }
+  data_ = static_cast<char*>(data);
+  size_ = size;
+
+  uint32_t version;
+  memcpy(&version, data_ + 8, 4);
+  if (memcmp(data_, kTraceMagic, 8) != 0 || version != kTraceVersion) {
+    *error = trace_file + ": not a cache trace, or of another version";
+    return false;
+  }
+  size_t offset = kFileHeaderSize;
+  while (offset < size_) {
+    if (size_ - offset < kChunkHeaderSize) {
+      *error = trace_file + ": truncated";
+      return false;
+    }
+    uint32_t thread;
+    uint32_t chunk_size;
+    memcpy(&thread, data_ + offset, 4);
+    memcpy(&chunk_size, data_ + offset + 4, 4);
+    offset += kChunkHeaderSize;
+    if (chunk_size > size_ - offset) {
+      *error = trace_file + ": truncated";
+      return false;
+    }
+    if (thread >= kMaxTraceThreads) {
+      *error = trace_file + ": corrupt record";
+      return false;
+    }
+    if (thread >= threads_.size()) {
+      threads_.resize(thread + 1);
+    }
+    std::vector<const char*>& records = threads_[thread];
+    const char* p = data_ + offset;
+    const char* end = p + chunk_size;
+    while (p < end) {
+      size_t left = static_cast<size_t>(end - p);
+      if (left < CacheTraceRecord::kHeaderSize) {
+        *error = trace_file + ": corrupt record";
+        return false;
+      }
+      CacheTraceRecord record = CacheTraceRecord::Decode(p);
+      size_t record_size = CacheTraceRecord::kHeaderSize + record.key.size();
+      // An op or priority a replay would not know is corruption too, not a
+      // record to skip.
+      if (record_size > left || static_cast<uint8_t>(record.op) > kTraceErase ||
+          (record.priority != Cache::Priority::HIGH &&
+           record.priority != Cache::Priority::LOW)) {
+        *error = trace_file + ": corrupt record";
+        return false;
+      }
+      records.push_back(p);
+      p += record_size;
+    }
+    offset += chunk_size;
+  }
+  return true;
+}
+
+uint64_t CacheTraceReader::NumRecords() const {
+  uint64_t n = 0;
+  for (const auto& records : threads_) {
+    n += records.size();
+  }
+  return n;
+}
@@ -0,0 +1,276 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+#include "port.h"
+
+// Cache traces record the key-level ops an application issues against a
+// Cache, so that they can be replayed against other policies, capacities
+// and shard counts (see cache_bench -trace_file).
+//
+// File format, in native byte order:
+//
+//   header: "CACHETRC" (8 bytes), version (4), unused (4),
+//           wall clock at the start of the trace in micros (8)
+//   chunk*: traced thread (4), size of the records that follow (4)
+//   record: nanos since the start of the trace (8), charge (8), key hash as
+//           in HashedKey (4), key size (4), CacheTraceOp (1),
+//           Cache::Priority (1), key bytes
+//
+// Each chunk holds consecutive records of one thread, and the chunks of a
+// thread appear in order, so per-thread order is preserved. Chunks of
+// different threads interleave in the order they were flushed.
+enum CacheTraceOp : uint8_t {
+  kTraceLookup = 0,
+  kTraceInsert = 1,
+  kTraceErase = 2,
+};
+
+struct CacheTraceRecord {
+  uint64_t timestamp;
+  uint64_t charge;
+  uint32_t hash;
+  CacheTraceOp op;
+  Cache::Priority priority;
+  Slice key;
+
+  static const size_t kHeaderSize = 26;
+
+  // Decodes the record at p, which must lie in a chunk of a valid trace.
+  static CacheTraceRecord Decode(const char* p) {
+    CacheTraceRecord record;
+    uint32_t key_size;
+    memcpy(&record.timestamp, p, 8);
+    memcpy(&record.charge, p + 8, 8);
+    memcpy(&record.hash, p + 16, 4);
+    memcpy(&key_size, p + 20, 4);
+    record.op = static_cast<CacheTraceOp>(p[24]);
+    record.priority = static_cast<Cache::Priority>(p[25]);
+    record.key = Slice(p + kHeaderSize, key_size);
+    return record;
+  }
+
+  // Appends the encoding of this record to *out.
+  void EncodeTo(std::string* out) const {
+    uint32_t key_size = static_cast<uint32_t>(key.size());
+    char header[kHeaderSize];
+    memcpy(header, &timestamp, 8);
+    memcpy(header + 8, &charge, 8);
+    memcpy(header + 16, &hash, 4);
+    memcpy(header + 20, &key_size, 4);
+    header[24] = static_cast<char>(op);
+    header[25] = static_cast<char>(priority);
+    out->append(header, sizeof(header));
+    out->append(key.data(), key_size);
+  }
+};
+
+// A Cache that forwards every call to target and appends its Lookup, Insert
+// and Erase ops to a trace file. MultiLookup() and MultiInsert() are traced
+// per key, Get() as a lookup, and GetOrCreate() as a lookup followed by an
+// insert if it ran create.
+//
+// Each thread appends to its own buffer without locking. Full buffers are
+// handed to a background thread that writes them out; a thread that gets
+// too far ahead of the writer waits for it, so no op is dropped. Keys given
+// without a hash are hashed here once and passed on as HashedKey, so the
+// target does not hash them again.
+class TracingCache : public Cache {
+ public:
+  // Use NewTracingCache().
+  TracingCache(std::shared_ptr<Cache> target, FILE* file);
+  // Calls EndTrace().
+  virtual ~TracingCache();
+
+  // Writes out every thread's buffer and closes the trace file. Later ops
+  // are forwarded but not traced. Returns false if any write failed.
+  // REQUIRES: no other thread is using the cache.
+  bool EndTrace();
+
+  virtual const char* Name() const override { return "TracingCache"; }
+
+  virtual bool Insert(const Slice& key, void* value, size_t charge,
+                      void (*deleter)(const Slice& key, void* value),
+                      Handle** handle = nullptr,
+                      Priority priority = Priority::LOW) override {
+    return Insert(HashedKey(key), value, charge, deleter, handle, priority);
+  }
+  virtual bool Insert(const HashedKey& key, void* value, size_t charge,
+                      void (*deleter)(const Slice& key, void* value),
+                      Handle** handle = nullptr,
+                      Priority priority = Priority::LOW) override;
+  virtual void MultiInsert(const Slice* keys, void* const* values,
+                           const size_t* charges, size_t n,
+                           void (*deleter)(const Slice& key, void* value),
+                           Priority priority = Priority::LOW) override;
+  virtual Handle* Lookup(const Slice& key) override {
+    return Lookup(HashedKey(key));
+  }
+  virtual Handle* Lookup(const HashedKey& key) override;
+  virtual void MultiLookup(const Slice* keys, size_t n,
+                           Handle** handles) override;
+  virtual bool Get(const Slice& key, const ReadCallback& reader) override;
+  virtual Handle* GetOrCreate(const Slice& key, const CreateCallback& create,
+                              void (*deleter)(const Slice& key, void* value),
+                              Priority priority = Priority::LOW) override;
+  virtual void Erase(const Slice& key) override { Erase(HashedKey(key)); }
+  virtual void Erase(const HashedKey& key) override;
+
+  virtual bool Ref(Handle* handle) override { return target_->Ref(handle); }
+  virtual bool Release(Handle* handle, bool force_erase = false) override {
+    return target_->Release(handle, force_erase);
+  }
+  virtual void* Value(Handle* handle) override {
+    return target_->Value(handle);
+  }
+  virtual uint64_t NewId() override { return target_->NewId(); }
+  virtual bool EraseNamespace(uint64_t id) override {
+    return target_->EraseNamespace(id);
+  }
+  virtual void SetCapacity(size_t capacity) override {
+    target_->SetCapacity(capacity);
+  }
+  virtual void SetStrictCapacityLimit(bool strict_capacity_limit) override {
+    target_->SetStrictCapacityLimit(strict_capacity_limit);
+  }
+  virtual bool HasStrictCapacityLimit() const override {
+    return target_->HasStrictCapacityLimit();
+  }
+  virtual size_t GetCapacity() const override {
+    return target_->GetCapacity();
+  }
+  virtual size_t GetUsage() const override { return target_->GetUsage(); }
+  virtual size_t GetUsage(Handle* handle) const override {
+    return target_->GetUsage(handle);
+  }
+  virtual size_t GetPinnedUsage() const override {
+    return target_->GetPinnedUsage();
+  }
+  virtual size_t GetMetadataUsage() const override {
+    return target_->GetMetadataUsage();
+  }
+  virtual void GetShardUsage(std::vector<size_t>* usage) const override {
+    target_->GetShardUsage(usage);
+  }
+  virtual bool Reserve(uint32_t hash, size_t charge) override {
+    return target_->Reserve(hash, charge);
+  }
+  virtual void Unreserve(uint32_t hash, size_t charge) override {
+    target_->Unreserve(hash, charge);
+  }
+  virtual size_t GetReservedUsage() const override {
+    return target_->GetReservedUsage();
+  }
+  virtual size_t GetCharge(Handle* handle) const override {
+    return target_->GetCharge(handle);
+  }
+  virtual void DisownData() override { target_->DisownData(); }
+  virtual void ApplyToAllCacheEntries(void (*callback)(void*, size_t),
+                                      bool thread_safe) override {
+    target_->ApplyToAllCacheEntries(callback, thread_safe);
+  }
+  virtual void ApplyToAllEntries(const EntryCallback& callback,
+                                 size_t entries_per_lock = 256,
+                                 Env* env = nullptr) override {
+    target_->ApplyToAllEntries(callback, entries_per_lock, env);
+  }
+  virtual void EraseUnRefEntries() override { target_->EraseUnRefEntries(); }
+  virtual std::string GetPrintableOptions() const override {
+    return target_->GetPrintableOptions();
+  }
+  virtual void PrintCacheInfo() override { target_->PrintCacheInfo(); }
+
+ private:
+  // Records of one thread not yet handed to the writer.
+  struct ThreadBuffer {
+    uint32_t thread;
+    std::string records;
+  };
+
+  // A buffer handed to the writer.
+  struct Chunk {
+    uint32_t thread;
+    std::string records;
+  };
+
+  // A thread hands its buffer over once it holds this many bytes.
+  static const size_t kChunkSize = 256 << 10;
+  // Threads wait for the writer while it has this many bytes queued.
+  static const size_t kMaxPendingBytes = 64 << 20;
+
+  void Append(CacheTraceOp op, const HashedKey& key, size_t charge,
+              Priority priority);
+  ThreadBuffer* GetThreadBuffer();
+  void Submit(ThreadBuffer* buffer);
+  bool WriteChunk(const Chunk& chunk);
+  void WriterLoop();
+
+  const std::shared_ptr<Cache> target_;
+  // Tells the thread-local buffer cache of one TracingCache from another's.
+  const uint64_t id_;
+  const std::chrono::steady_clock::time_point start_;
+  std::atomic<bool> tracing_;
+
+  port::Mutex mutex_;
+  port::CondVar cv_;
+  // Everything below is guarded by mutex_.
+  std::unordered_map<std::thread::id, std::unique_ptr<ThreadBuffer>>
+      buffers_;
+  std::deque<Chunk> pending_;
+  size_t pending_bytes_;
+  bool closing_;
+  // Written by the writer thread only, until it is joined.
+  FILE* file_;
+  bool write_ok_;
+  port::Thread writer_;
+};
+
+// Returns a TracingCache over target that writes to trace_file, or nullptr
+// if trace_file cannot be created.
+extern std::shared_ptr<TracingCache> NewTracingCache(
+    std::shared_ptr<Cache> target, const std::string& trace_file);
+
+// A trace file mapped into memory, with the records of each traced thread
+// indexed in order. Records point into the mapping, which lives as long as
+// the reader.
+class CacheTraceReader {
+ public:
+  CacheTraceReader() : data_(nullptr), size_(0) {}
+  ~CacheTraceReader();
+
+  // Maps trace_file and indexes its records. Returns false with a message
+  // in *error if it cannot be read or is not a valid trace.
+  bool Open(const std::string& trace_file, std::string* error);
+
+  size_t NumThreads() const { return threads_.size(); }
+  // The records of traced thread i, for CacheTraceRecord::Decode().
+  const std::vector<const char*>& ThreadRecords(size_t i) const {
+    return threads_[i];
+  }
+  uint64_t NumRecords() const;
+
+ private:
+  char* data_;
+  size_t size_;
+  std::vector<std::vector<const char*>> threads_;
+
+  // No copying allowed
+  CacheTraceReader(const CacheTraceReader&);
+  void operator=(const CacheTraceReader&);
+};
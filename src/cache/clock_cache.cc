@@ -24,6 +24,8 @@
 #endif
 #include "tbb/concurrent_hash_map.h"
 
+#include "async_deleter.h"
+#include "autovector.h"
 #include "sharded_cache.h"
 #include "port.h"
 
@@ -159,8 +161,13 @@
 struct CacheHandle {
   Slice key;
   uint32_t hash;
+  // The generation of the key's namespace when the entry was inserted.
+  uint32_t generation;
   void* value;
   size_t charge;
+  // charge plus the key copy and hash map node if the cache charges
+  // metadata. This is what usage_ and pinned_usage_ account.
+  size_t total_charge;
   void (*deleter)(const Slice&, void* value);
 
   // Flags and counters associated with the cache handle:
@@ -175,14 +182,16 @@ struct CacheHandle {
 
   CacheHandle(const CacheHandle& a) { *this = a; }
 
-  CacheHandle(const Slice& k, void* v,
+  CacheHandle(const Slice& k, void* v, size_t c,
               void (*del)(const Slice& key, void* value))
-      : key(k), value(v), deleter(del) {}
+      : key(k), value(v), charge(c), total_charge(c), deleter(del) {}
 
   CacheHandle& operator=(const CacheHandle& a) {
     // Only copy members needed for deletion.
     key = a.key;
     value = a.value;
+    charge = a.charge;
+    total_charge = a.total_charge;
     deleter = a.deleter;
     return *this;
   }
@@ -209,12 +218,24 @@ struct CacheKey {
   }
 };
 
+// Each operation borrows the thread's CleanupContext through
+// ScopedThreadLocal, so the lists keep their storage between calls.
 struct CleanupContext {
   // List of values to be deleted, along with the key and deleter.
-  std::vector<CacheHandle> to_delete_value;
+  autovector<CacheHandle> to_delete_value;
 
   // List of keys to be deleted.
-  std::vector<const char*> to_delete_key;
+  autovector<const char*> to_delete_key;
+
+  void clear() {
+    to_delete_value.clear();
+    to_delete_key.clear();
+  }
+
+  void clear_and_trim(size_t max_retained) {
+    to_delete_value.clear_and_trim(max_retained);
+    to_delete_key.clear_and_trim(max_retained);
+  }
 };
 
 // A cache shard which maintains its own CLOCK cache.
@@ -223,16 +244,35 @@ class ClockCacheShard final : public CacheShard {
   // Hash map type.
   typedef tbb::concurrent_hash_map<CacheKey, CacheHandle*, CacheKey> HashTable;
 
-  ClockCacheShard();
+  explicit ClockCacheShard(AsyncDeleter* async_deleter = nullptr,
+                           bool metadata_charged = false,
+                           const NamespaceGenerations* namespaces = nullptr);
   ~ClockCacheShard() override;
 
+  // See LRUCacheShard::SetMutexProfileName().
+  void SetMutexProfileName(int shard) {
+    mutex_.SetProfileName("ClockCacheShard::mutex_", shard);
+  }
+
   // Interfaces
   void SetCapacity(size_t capacity) override;
   void SetStrictCapacityLimit(bool strict_capacity_limit) override;
   bool Insert(const Slice& key, uint32_t hash, void* value, size_t charge,
                 void (*deleter)(const Slice& key, void* value),
                 Cache::Handle** handle, Cache::Priority priority) override;
+  // Copies the keys before taking mutex_, then evicts once for the total
+  // charge and inserts the batch under one lock hold.
+  void MultiInsert(const Slice* keys, const uint32_t* hashes,
+                   void* const* values, const size_t* charges,
+                   const size_t* indexes, size_t n,
+                   void (*deleter)(const Slice& key, void* value),
+                   Cache::Priority priority) override;
   Cache::Handle* Lookup(const Slice& key, uint32_t hash) override;
+  // Runs reader while holding a const_accessor on the table entry instead
+  // of a reference. Eviction and erase remove the entry from the table
+  // before recycling the handle, which waits for the accessor.
+  bool Get(const Slice& key, uint32_t hash,
+           const Cache::ReadCallback& reader) override;
   // If the entry in in cache, increase reference count and return true.
   // Return false otherwise.
   //
@@ -244,9 +284,17 @@ class ClockCacheShard final : public CacheShard {
                        CleanupContext* context);
   size_t GetUsage() const override;
   size_t GetPinnedUsage() const override;
+  size_t GetMetadataUsage() const override;
+  bool Reserve(size_t charge) override;
+  void Unreserve(size_t charge) override;
+  size_t GetReservedUsage() const override;
   void EraseUnRefEntries() override;
   void ApplyToAllCacheEntries(void (*callback)(void*, size_t),
                               bool thread_safe) override;
+  // Walks list_ by index, taking mutex_ once per chunk of handles. Handles
+  // never move, and new ones are appended.
+  void ApplyToAllEntries(const Cache::EntryCallback& callback,
+                         size_t entries_per_lock) override;
 	void PrintCacheInfo() override ;
 
  private:
@@ -257,6 +305,12 @@ class ClockCacheShard final : public CacheShard {
 
   // Helper functions to extract cache handle flags and counters.
   static bool InCache(uint32_t flags) { return flags & kInCacheBit; }
+
+  // Whether handle's namespace has been erased since it was inserted.
+  bool IsStale(const CacheHandle* handle) const {
+    return namespaces_ != nullptr &&
+           namespaces_->IsStale(handle->key, handle->generation);
+  }
   static bool HasUsage(uint32_t flags) { return flags & kUsageBit; }
   static uint32_t CountRefs(uint32_t flags) { return flags >> kRefsOffset; }
 
@@ -283,7 +337,8 @@ class ClockCacheShard final : public CacheShard {
   void RecycleHandle(CacheHandle* handle, CleanupContext* context);
 
   // Delete keys and values in to-be-deleted list. Call the method without
-  // holding mutex, as destructors can be expensive.
+  // holding mutex, as destructors can be expensive. If async_deleter_ is set
+  // the deletion is handed over to it instead.
   void Cleanup(const CleanupContext& context);
 
   // Examine the handle for eviction. If the handle is in cache, usage bit is
@@ -301,10 +356,34 @@ class ClockCacheShard final : public CacheShard {
   bool EvictFromCache(size_t charge, CleanupContext* context);
 
   CacheHandle* Insert(const Slice& key, uint32_t hash, void* value,
-                      size_t change,
+                      size_t charge, size_t total_charge,
                       void (*deleter)(const Slice& key, void* value),
                       bool hold_reference, CleanupContext* context);
 
+  // Insert() for callers that already hold mutex_.
+  CacheHandle* InsertLocked(const Slice& key, uint32_t hash, void* value,
+                            size_t charge, size_t total_charge,
+                            void (*deleter)(const Slice& key, void* value),
+                            bool hold_reference, CleanupContext* context);
+
+  // Copy key into memory owned by the cache and return the charge the
+  // entry will be accounted with.
+  //
+  // Not necessary to hold mutex_ before being called.
+  size_t CopyKey(const Slice& key, size_t charge, Slice* key_copy) const;
+
+  // Charge the growth of list_, recycle_ and the hash map's bucket array
+  // since the last call.
+  //
+  // Has to hold mutex_ before being called.
+  void UpdateTableCharge();
+
+  // Rough size of a tbb::concurrent_hash_map node and bucket; the map does
+  // not expose its internals.
+  static const size_t kHashNodeOverhead =
+      sizeof(std::pair<const CacheKey, CacheHandle*>) + 2 * sizeof(void*);
+  static const size_t kHashBucketOverhead = 2 * sizeof(void*);
+
   // Guards list_, head_, and recycle_. In addition, updating table_ also has
   // to hold the mutex, to avoid the cache being in inconsistent state.
   mutable port::Mutex mutex_;
@@ -332,18 +411,51 @@ class ClockCacheShard final : public CacheShard {
   // Current total size of the cache.
   std::atomic<size_t> usage_;
 
-  // Total un-released cache size.
-  std::atomic<size_t> pinned_usage_;
-
   // Whether allow insert into cache if cache is full.
   std::atomic<bool> strict_capacity_limit_;
 
+  // Total un-released cache size. Updated by every Lookup() and Release(),
+  // so it gets a cache line of its own, away from the fields Insert() and
+  // GetUsage() read.
+  ALIGN_AS(CACHE_LINE_SIZE) std::atomic<size_t> pinned_usage_;
+
   // Hash table (tbb::concurrent_hash_map) for lookup.
-  HashTable table_;
+  ALIGN_AS(CACHE_LINE_SIZE) HashTable table_;
+
+  // Owned by the ClockCache. nullptr if deleters run inline.
+  AsyncDeleter* const async_deleter_;
+
+  // The owning cache's namespace generations, or nullptr.
+  const NamespaceGenerations* const namespaces_;
+
+  // Whether key, hash map and handle memory is charged against capacity_.
+  const bool metadata_charged_;
+
+  // Part of usage_ that is metadata.
+  std::atomic<size_t> metadata_usage_;
+
+  // Bytes of list_, recycle_ and hash map buckets charged to usage_.
+  // Guarded by mutex_.
+  size_t table_charge_;
+
+  // Capacity held by Reserve(). Not part of usage_ or pinned_usage_;
+  // EvictFromCache() adds it in.
+  std::atomic<size_t> reserved_usage_;
 };
 
-ClockCacheShard::ClockCacheShard()
-    : head_(0), usage_(0), pinned_usage_(0), strict_capacity_limit_(false) {}
+ClockCacheShard::ClockCacheShard(AsyncDeleter* async_deleter,
+                                 bool metadata_charged,
+                                 const NamespaceGenerations* namespaces)
+    : head_(0),
+      usage_(0),
+      strict_capacity_limit_(false),
+      pinned_usage_(0),
+      async_deleter_(async_deleter),
+      namespaces_(namespaces),
+      metadata_charged_(metadata_charged),
+      metadata_usage_(0),
+      table_charge_(0),
+      reserved_usage_(0) {}
 
 ClockCacheShard::~ClockCacheShard() {
   for (auto& handle : list_) {
@@ -358,11 +470,31 @@ ClockCacheShard::~ClockCacheShard() {
 }
 
 size_t ClockCacheShard::GetUsage() const {
-  return usage_.load(std::memory_order_relaxed);
+  return usage_.load(std::memory_order_relaxed) +
+         reserved_usage_.load(std::memory_order_relaxed);
 }
 
 size_t ClockCacheShard::GetPinnedUsage() const {
-  return pinned_usage_.load(std::memory_order_relaxed);
+  return pinned_usage_.load(std::memory_order_relaxed) +
+         reserved_usage_.load(std::memory_order_relaxed);
+}
+
+size_t ClockCacheShard::GetMetadataUsage() const {
+  return metadata_usage_.load(std::memory_order_relaxed);
+}
+
+void ClockCacheShard::UpdateTableCharge() {
+  mutex_.AssertHeld();
+  size_t table_memory = list_.size() * sizeof(CacheHandle) +
+                        recycle_.capacity() * sizeof(CacheHandle*) +
+                        table_.bucket_count() * kHashBucketOverhead;
+  if (table_memory != table_charge_) {
+    // Signed arithmetic is fine here: the unsigned wrap-around cancels out.
+    usage_.fetch_add(table_memory - table_charge_, std::memory_order_relaxed);
+    metadata_usage_.fetch_add(table_memory - table_charge_,
+                              std::memory_order_relaxed);
+    table_charge_ = table_memory;
+  }
 }
 
 void ClockCacheShard::ApplyToAllCacheEntries(void (*callback)(void*, size_t),
@@ -383,6 +515,29 @@ void ClockCacheShard::ApplyToAllCacheEntries(void (*callback)(void*, size_t),
   }
 }
 
+void ClockCacheShard::ApplyToAllEntries(const Cache::EntryCallback& callback,
+                                        size_t entries_per_lock) {
+  size_t i = 0;
+  bool more = true;
+  while (more) {
+    MutexLock l(&mutex_);
+    size_t end = list_.size();
+    if (entries_per_lock < end - i) {
+      end = i + (entries_per_lock > 0 ? entries_per_lock : 1);
+    }
+    for (; i < end; i++) {
+      const CacheHandle& handle = list_[i];
+      // Relaxed is enough as the in-cache bit only changes under mutex_.
+      uint32_t flags = handle.flags.load(std::memory_order_relaxed);
+      if (InCache(flags) && !IsStale(&handle) &&
+          !callback(handle.key, handle.value, handle.charge)) {
+        return;
+      }
+    }
+    more = i < list_.size();
+  }
+}
+
 void PrintHead() {
 	const char* head1 = "key";
 	const char* head2 = "value";
@@ -426,7 +581,8 @@ void ClockCacheShard::PrintCacheInfo() {
 		if (&list_[i] != nullptr) {
 			fprintf(stdout, "%-20s %-20s %-20d %-20d %-20d %-20u\n",
 							list_[i].key.ToString().c_str(),
-							strcmp(static_cast<char*> (list_[i].value), "") ? "-":"val" ,
+							list_[i].value == nullptr ||
+									strcmp(static_cast<char*> (list_[i].value), "") ? "-":"val" ,
 							InCache(list_[i].flags),
 							HasUsage(list_[i].flags),
 							CountRefs(list_[i].flags),
@@ -439,7 +595,8 @@ void ClockCacheShard::PrintCacheInfo() {
 	for (int i = 0; i < recycle_.size(); i++) {
 		fprintf(stdout, "%-20s %-20s %-20u\n",
 		        recycle_[i]->key.ToString().c_str(),
-						static_cast<char*>(recycle_[i]->value),
+						recycle_[i]->value == nullptr
+								? "-" : static_cast<char*>(recycle_[i]->value),
 						recycle_[i]->hash);
 	}
 }
@@ -454,10 +611,29 @@ void ClockCacheShard::RecycleHandle(CacheHandle* handle,
   handle->value = nullptr;
   handle->deleter = nullptr;
   recycle_.push_back(handle);
-  usage_.fetch_sub(handle->charge, std::memory_order_relaxed);
+  usage_.fetch_sub(handle->total_charge, std::memory_order_relaxed);
+  if (metadata_charged_) {
+    metadata_usage_.fetch_sub(handle->total_charge - handle->charge,
+                              std::memory_order_relaxed);
+  }
 }
 
 void ClockCacheShard::Cleanup(const CleanupContext& context) {
+  if (async_deleter_ != nullptr &&
+      (!context.to_delete_value.empty() || !context.to_delete_key.empty())) {
+    // Values first: their deleters still get to see the key, which lives in
+    // one of the key buffers freed after them.
+    AsyncDeleter::Batch* batch = new AsyncDeleter::Batch();
+    for (const CacheHandle& handle : context.to_delete_value) {
+      batch->Add(handle.deleter, handle.key, handle.value,
+                 handle.total_charge, nullptr);
+    }
+    for (const char* key : context.to_delete_key) {
+      batch->Add(nullptr, Slice(), nullptr, 0, const_cast<char*>(key));
+    }
+    async_deleter_->Submit(batch);
+    return;
+  }
   for (const CacheHandle& handle : context.to_delete_value) {
     if (handle.deleter) {
       (*handle.deleter)(handle.key, handle.value);
@@ -480,7 +656,8 @@ bool ClockCacheShard::Ref(Cache::Handle* h) {
                                             std::memory_order_relaxed)) {
       if (CountRefs(flags) == 0) {
         // No reference count before the operation.
-        pinned_usage_.fetch_add(handle->charge, std::memory_order_relaxed);
+        pinned_usage_.fetch_add(handle->total_charge,
+                                std::memory_order_relaxed);
       }
       return true;
     }
@@ -500,7 +677,7 @@ bool ClockCacheShard::Unref(CacheHandle* handle, bool set_usage,
   assert(CountRefs(flags) > 0);
   if (CountRefs(flags) == 1) {
     // this is the last reference.
-    pinned_usage_.fetch_sub(handle->charge, std::memory_order_relaxed);
+    pinned_usage_.fetch_sub(handle->total_charge, std::memory_order_relaxed);
     // Cleanup if it is the last reference.
     if (!InCache(flags)) {
       MutexLock l(&mutex_);
@@ -510,6 +687,33 @@ bool ClockCacheShard::Unref(CacheHandle* handle, bool set_usage,
   return context->to_delete_value.size();
 }
 
+bool ClockCacheShard::Reserve(size_t charge) {
+  if (!strict_capacity_limit_.load(std::memory_order_relaxed)) {
+    reserved_usage_.fetch_add(charge, std::memory_order_relaxed);
+    return true;
+  }
+  ScopedThreadLocal<CleanupContext> context;
+  bool success;
+  {
+    MutexLock l(&mutex_);
+    success = EvictFromCache(charge, context.get());
+    if (success) {
+      reserved_usage_.fetch_add(charge, std::memory_order_relaxed);
+    }
+  }
+  Cleanup(*context);
+  return success;
+}
+
+void ClockCacheShard::Unreserve(size_t charge) {
+  assert(reserved_usage_.load(std::memory_order_relaxed) >= charge);
+  reserved_usage_.fetch_sub(charge, std::memory_order_relaxed);
+}
+
+size_t ClockCacheShard::GetReservedUsage() const {
+  return reserved_usage_.load(std::memory_order_relaxed);
+}
+
 bool ClockCacheShard::UnsetInCache(CacheHandle* handle,
                                    CleanupContext* context) {
   mutex_.AssertHeld();
@@ -541,17 +745,18 @@ bool ClockCacheShard::TryEvict(CacheHandle* handle, CleanupContext* context) {
 }
 
 bool ClockCacheShard::EvictFromCache(size_t charge, CleanupContext* context) {
-  size_t usage = usage_.load(std::memory_order_relaxed);
+  size_t reserved = reserved_usage_.load(std::memory_order_relaxed);
+  size_t usage = usage_.load(std::memory_order_relaxed) + reserved;
   size_t capacity = capacity_.load(std::memory_order_relaxed);
-  if (usage == 0) {
-    return charge <= capacity;
+  if (usage == reserved) {
+    return usage + charge <= capacity;
   }
   size_t new_head = head_;
   bool second_iteration = false;
   while (usage + charge > capacity) {
     assert(new_head < list_.size());
     if (TryEvict(&list_[new_head], context)) {
-      usage = usage_.load(std::memory_order_relaxed);
+      usage = usage_.load(std::memory_order_relaxed) + reserved;
     }
     new_head = (new_head + 1 >= list_.size()) ? 0 : new_head + 1;
     if (new_head == head_) {
@@ -567,13 +772,13 @@ bool ClockCacheShard::EvictFromCache(size_t charge, CleanupContext* context) {
 }
 
 void ClockCacheShard::SetCapacity(size_t capacity) {
-  CleanupContext context;
+  ScopedThreadLocal<CleanupContext> context;
   {
     MutexLock l(&mutex_);
     capacity_.store(capacity, std::memory_order_relaxed);
-    EvictFromCache(0, &context);
+    EvictFromCache(0, context.get());
   }
-  Cleanup(context);
+  Cleanup(*context);
 }
 
 void ClockCacheShard::SetStrictCapacityLimit(bool strict_capacity_limit) {
@@ -583,15 +788,24 @@ void ClockCacheShard::SetStrictCapacityLimit(bool strict_capacity_limit) {
 
 CacheHandle* ClockCacheShard::Insert(
     const Slice& key, uint32_t hash, void* value, size_t charge,
-    void (*deleter)(const Slice& key, void* value), bool hold_reference,
-    CleanupContext* context) {
+    size_t total_charge, void (*deleter)(const Slice& key, void* value),
+    bool hold_reference, CleanupContext* context) {
   MutexLock l(&mutex_);
-  bool success = EvictFromCache(charge, context);
+  return InsertLocked(key, hash, value, charge, total_charge, deleter,
+                      hold_reference, context);
+}
+
+CacheHandle* ClockCacheShard::InsertLocked(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    size_t total_charge, void (*deleter)(const Slice& key, void* value),
+    bool hold_reference, CleanupContext* context) {
+  mutex_.AssertHeld();
+  bool success = EvictFromCache(total_charge, context);
   bool strict = strict_capacity_limit_.load(std::memory_order_relaxed);
   if (!success && (strict || !hold_reference)) {
     context->to_delete_key.push_back(key.data());
     if (!hold_reference) {
-      context->to_delete_value.emplace_back(key, value, deleter);
+      context->to_delete_value.emplace_back(key, value, charge, deleter);
     }
     return nullptr;
   }
@@ -608,8 +822,11 @@ CacheHandle* ClockCacheShard::Insert(
   // Fill handle.
   handle->key = key;
   handle->hash = hash;
+  handle->generation =
+      namespaces_ != nullptr ? namespaces_->Current(key) : 0;
   handle->value = value;
   handle->charge = charge;
+  handle->total_charge = total_charge;
   handle->deleter = deleter;
   uint32_t flags = hold_reference ? kInCacheBit + kOneRef : kInCacheBit;
   handle->flags.store(flags, std::memory_order_relaxed);
@@ -621,9 +838,14 @@ CacheHandle* ClockCacheShard::Insert(
   }
   table_.insert(HashTable::value_type(CacheKey(key, hash), handle));
   if (hold_reference) {
-    pinned_usage_.fetch_add(charge, std::memory_order_relaxed);
+    pinned_usage_.fetch_add(total_charge, std::memory_order_relaxed);
+  }
+  usage_.fetch_add(total_charge, std::memory_order_relaxed);
+  if (metadata_charged_) {
+    metadata_usage_.fetch_add(total_charge - charge,
+                              std::memory_order_relaxed);
+    UpdateTableCharge();
   }
-  usage_.fetch_add(charge, std::memory_order_relaxed);
   return handle;
 }
 
@@ -632,13 +854,12 @@ bool ClockCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
                                void (*deleter)(const Slice& key, void* value),
                                Cache::Handle** out_handle,
                                Cache::Priority /*priority*/) {
-  CleanupContext context;
-  HashTable::accessor accessor;
-  char* key_data = new char[key.size()];
-  memcpy(key_data, key.data(), key.size());
-  Slice key_copy(key_data, key.size());
-  CacheHandle* handle = Insert(key_copy, hash, value, charge, deleter,
-                               out_handle != nullptr, &context);
+  ScopedThreadLocal<CleanupContext> context;
+  Slice key_copy;
+  size_t total_charge = CopyKey(key, charge, &key_copy);
+  CacheHandle* handle =
+      Insert(key_copy, hash, value, charge, total_charge, deleter,
+             out_handle != nullptr, context.get());
   bool s = true;
   if (out_handle != nullptr) {
     if (handle == nullptr) {
@@ -647,10 +868,52 @@ bool ClockCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
       *out_handle = reinterpret_cast<Cache::Handle*>(handle);
     }
   }
-  Cleanup(context);
+  Cleanup(*context);
   return s;
 }
 
+void ClockCacheShard::MultiInsert(
+    const Slice* keys, const uint32_t* hashes, void* const* values,
+    const size_t* charges, const size_t* indexes, size_t n,
+    void (*deleter)(const Slice& key, void* value),
+    Cache::Priority /*priority*/) {
+  ScopedThreadLocal<CleanupContext> context;
+  std::vector<Slice> key_copies(n);
+  std::vector<size_t> total_charges(n);
+  size_t batch_charge = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t k = indexes[i];
+    total_charges[i] = CopyKey(keys[k], charges[k], &key_copies[i]);
+    batch_charge += total_charges[i];
+  }
+  {
+    MutexLock l(&mutex_);
+    // Make room for the whole batch in one pass. InsertLocked() only evicts
+    // again if the batch is larger than the shard.
+    EvictFromCache(batch_charge, context.get());
+    for (size_t i = 0; i < n; i++) {
+      size_t k = indexes[i];
+      InsertLocked(key_copies[i], hashes[k], values[k], charges[k],
+                   total_charges[i], deleter, false /* hold_reference */,
+                   context.get());
+    }
+  }
+  Cleanup(*context);
+}
+
+size_t ClockCacheShard::CopyKey(const Slice& key, size_t charge,
+                                Slice* key_copy) const {
+  char* key_data = new char[key.size()];
+  memcpy(key_data, key.data(), key.size());
+  *key_copy = Slice(key_data, key.size());
+  size_t total_charge = charge;
+  if (metadata_charged_) {
+    total_charge +=
+        port::MallocUsableSize(key_data, key.size()) + kHashNodeOverhead;
+  }
+  return total_charge;
+}
+
 Cache::Handle* ClockCacheShard::Lookup(const Slice& key, uint32_t hash) {
   HashTable::const_accessor accessor;
   if (!table_.find(accessor, CacheKey(key, hash))) {
@@ -665,32 +928,52 @@ Cache::Handle* ClockCacheShard::Lookup(const Slice& key, uint32_t hash) {
   }
   // Double check the key since the handle may now representing another key
   // if other threads sneak in, evict/erase the entry and re-used the handle
-  // for another cache entry.
-  if (hash != handle->hash || key.compare(handle->key) != 0) {
-    CleanupContext context;
-    Unref(handle, false, &context);
+  // for another cache entry. Entries of an erased namespace are misses too.
+  if (hash != handle->hash || key.compare(handle->key) != 0 ||
+      IsStale(handle)) {
+    ScopedThreadLocal<CleanupContext> context;
+    Unref(handle, false, context.get());
     // It is possible Unref() delete the entry, so we need to cleanup.
-    Cleanup(context);
+    Cleanup(*context);
     return nullptr;
   }
   return reinterpret_cast<Cache::Handle*>(handle);
 }
 
+bool ClockCacheShard::Get(const Slice& key, uint32_t hash,
+                          const Cache::ReadCallback& reader) {
+  HashTable::const_accessor accessor;
+  if (!table_.find(accessor, CacheKey(key, hash))) {
+    return false;
+  }
+  CacheHandle* handle = accessor->second;
+  if (!InCache(handle->flags.load(std::memory_order_relaxed))) {
+    // TryEvict() has claimed the entry and waits for the accessor.
+    return false;
+  }
+  if (IsStale(handle)) {
+    return false;
+  }
+  handle->flags.fetch_or(kUsageBit, std::memory_order_relaxed);
+  reader(handle->value, handle->charge);
+  return true;
+}
+
 bool ClockCacheShard::Release(Cache::Handle* h, bool force_erase) {
-  CleanupContext context;
+  ScopedThreadLocal<CleanupContext> context;
   CacheHandle* handle = reinterpret_cast<CacheHandle*>(h);
-  bool erased = Unref(handle, true, &context);
+  bool erased = Unref(handle, true, context.get());
   if (force_erase && !erased) {
-    erased = EraseAndConfirm(handle->key, handle->hash, &context);
+    erased = EraseAndConfirm(handle->key, handle->hash, context.get());
   }
-  Cleanup(context);
+  Cleanup(*context);
   return erased;
 }
 
 void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
-  CleanupContext context;
-  EraseAndConfirm(key, hash, &context);
-  Cleanup(context);
+  ScopedThreadLocal<CleanupContext> context;
+  EraseAndConfirm(key, hash, context.get());
+  Cleanup(*context);
 }
 
 bool ClockCacheShard::EraseAndConfirm(const Slice& key, uint32_t hash,
@@ -707,28 +990,45 @@ bool ClockCacheShard::EraseAndConfirm(const Slice& key, uint32_t hash,
 }
 
 void ClockCacheShard::EraseUnRefEntries() {
-  CleanupContext context;
+  ScopedThreadLocal<CleanupContext> context;
   {
     MutexLock l(&mutex_);
     table_.clear();
     for (auto& handle : list_) {
-      UnsetInCache(&handle, &context);
+      UnsetInCache(&handle, context.get());
     }
   }
-  Cleanup(context);
+  Cleanup(*context);
 }
 
 class ClockCache final : public ShardedCache {
  public:
-  ClockCache(size_t capacity, int num_shard_bits, bool strict_capacity_limit)
-      : ShardedCache(capacity, num_shard_bits, strict_capacity_limit) {
+  ClockCache(size_t capacity, int num_shard_bits, bool strict_capacity_limit,
+             int async_deleter_threads = 0, bool metadata_charged = false)
+      : ShardedCache(capacity, num_shard_bits, strict_capacity_limit,
+                     nullptr, async_deleter_threads) {
     int num_shards = 1 << num_shard_bits;
-    shards_ = new ClockCacheShard[num_shards];
+    shards_ = reinterpret_cast<ClockCacheShard*>(
+        port::cacheline_aligned_alloc(sizeof(ClockCacheShard) * num_shards));
+    for (int i = 0; i < num_shards; i++) {
+      new (&shards_[i])
+          ClockCacheShard(async_deleter(), metadata_charged, namespaces());
+      shards_[i].SetMutexProfileName(i);
+    }
+    num_shards_ = num_shards;
     SetCapacity(capacity);
     SetStrictCapacityLimit(strict_capacity_limit);
   }
 
-  ~ClockCache() override { delete[] shards_; }
+  ~ClockCache() override {
+    ShutdownAsyncDeleter();
+    if (shards_ != nullptr) {
+      for (int i = 0; i < num_shards_; i++) {
+        shards_[i].~ClockCacheShard();
+      }
+      port::cacheline_aligned_free(shards_);
+    }
+  }
 
   const char* Name() const override { return "ClockCache"; }
 
@@ -756,13 +1056,22 @@ class ClockCache final : public ShardedCache {
 
  private:
   ClockCacheShard* shards_;
+  int num_shards_ = 0;
 };
 
 std::shared_ptr<Cache> NewClockCache(size_t capacity, int num_shard_bits,
                                      bool strict_capacity_limit) {
+  return NewClockCache(
+      ClockCacheOptions(capacity, num_shard_bits, strict_capacity_limit));
+}
+
+std::shared_ptr<Cache> NewClockCache(const ClockCacheOptions& cache_opts) {
+  int num_shard_bits = cache_opts.num_shard_bits;
   if (num_shard_bits < 0) {
-    num_shard_bits = GetDefaultCacheShardBits(capacity);
+    num_shard_bits = GetDefaultCacheShardBits(cache_opts.capacity);
   }
-  return std::make_shared<ClockCache>(capacity, num_shard_bits,
-                                      strict_capacity_limit);
+  return std::make_shared<ClockCache>(cache_opts.capacity, num_shard_bits,
+                                      cache_opts.strict_capacity_limit,
+                                      cache_opts.async_deleter_threads,
+                                      cache_opts.metadata_charged);
 }
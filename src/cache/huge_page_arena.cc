@@ -0,0 +1,137 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "huge_page_arena.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <new>
+
+#include "sharded_cache.h"
+
+// MAP_HUGETLB alone maps the system's default huge page size, which may be
+// 1GB, or 512MB on arm64 with 64K base pages. The regions here are 2MB
+// multiples and unmapped as such, so ask for 2MB pages explicitly, and skip
+// hugetlb where the size cannot be named.
+#if defined(MAP_HUGETLB) && !defined(MAP_HUGE_2MB) && defined(MAP_HUGE_SHIFT)
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+namespace {
+
+size_t RoundUpToHugePage(size_t size) {
+  return (size + HugePageArena::kHugePageSize - 1) &
+         ~(HugePageArena::kHugePageSize - 1);
+}
+
+// Map size bytes (a multiple of kHugePageSize) aligned to kHugePageSize.
+char* MapRegion(size_t size) {
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_2MB)
+  static_assert(HugePageArena::kHugePageSize == (size_t(1) << 21),
+                "MAP_HUGE_2MB must match kHugePageSize");
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB,
+                    -1, 0);
+  if (addr != MAP_FAILED) {
+    return static_cast<char*>(addr);
+  }
+#endif
+  // No reserved huge pages. Over-map so the region can be trimmed to a
+  // huge page boundary, which transparent huge pages need.
+  const size_t mapped = size + HugePageArena::kHugePageSize;
+  void* raw = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    fprintf(stderr, "mmap of %" ROCKSDB_PRIszt " bytes failed\n", mapped);
+    abort();
+  }
+  uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+  uintptr_t aligned = (start + HugePageArena::kHugePageSize - 1) &
+                      ~(uintptr_t(HugePageArena::kHugePageSize) - 1);
+  if (aligned > start) {
+    munmap(raw, aligned - start);
+  }
+  size_t tail = (start + mapped) - (aligned + size);
+  if (tail > 0) {
+    munmap(reinterpret_cast<void*>(aligned + size), tail);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+  return reinterpret_cast<char*>(aligned);
+}
+
+}  // namespace
+
+HugePageArena::HugePageArena()
+    : alloc_ptr_(nullptr), alloc_bytes_remaining_(0) {
+  memset(free_lists_, 0, sizeof(free_lists_));
+}
+
+HugePageArena::~HugePageArena() {
+  for (char* region : regions_) {
+    munmap(region, kHugePageSize);
+  }
+}
+
+char* HugePageArena::Allocate(size_t size) {
+  if (size > kMaxSmallSize) {
+    return new char[size];
+  }
+  size_t size_class = SizeClass(size);
+  MutexLock l(&mutex_);
+  FreeBlock* block = free_lists_[size_class];
+  if (block != nullptr) {
+    free_lists_[size_class] = block->next;
+    return reinterpret_cast<char*>(block);
+  }
+  size_t block_size = (size_class + 1) * kAlignment;
+  if (alloc_bytes_remaining_ < block_size) {
+    // The tail of the old region is lost; at most kMaxSmallSize per region.
+    alloc_ptr_ = MapRegion(kHugePageSize);
+    alloc_bytes_remaining_ = kHugePageSize;
+    regions_.push_back(alloc_ptr_);
+  }
+  char* result = alloc_ptr_;
+  alloc_ptr_ += block_size;
+  alloc_bytes_remaining_ -= block_size;
+  return result;
+}
+
+void HugePageArena::Deallocate(char* p, size_t size) {
+  if (size > kMaxSmallSize) {
+    delete[] p;
+    return;
+  }
+  size_t size_class = SizeClass(size);
+  FreeBlock* block = reinterpret_cast<FreeBlock*>(p);
+  MutexLock l(&mutex_);
+  block->next = free_lists_[size_class];
+  free_lists_[size_class] = block;
+}
+
+size_t HugePageArena::UsableSize(size_t size) {
+  if (size > kMaxSmallSize) {
+    return size;
+  }
+  return (SizeClass(size) + 1) * kAlignment;
+}
+
+char* HugePageArena::AllocateLarge(size_t size) {
+  return MapRegion(RoundUpToHugePage(size));
+}
+
+void HugePageArena::DeallocateLarge(char* p, size_t size) {
+  munmap(p, RoundUpToHugePage(size));
+}
+
+size_t HugePageArena::GetMappedBytes() const {
+  MutexLock l(&mutex_);
+  return regions_.size() * kHugePageSize;
+}
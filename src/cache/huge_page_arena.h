@@ -0,0 +1,70 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+#include "port.h"
+
+// HugePageArena hands out a cache shard's entry memory from 2MB-aligned
+// anonymous mappings backed by huge pages, so that random lookups over a
+// large cache walk handles that share a few dTLB entries instead of one per
+// 4KB page.
+//
+// Regions are mapped with MAP_HUGETLB when the system has huge pages
+// reserved, and otherwise mapped normally and advised with MADV_HUGEPAGE so
+// transparent huge pages can back them. Where neither exists the arena still
+// works, just with the regular page size.
+//
+// Small blocks are carved from the current region and recycled through
+// per-size-class free lists; memory goes back to the system only when the
+// arena is destroyed. Callers must pass the allocation size back to
+// Deallocate(). All methods are thread-safe.
+class HugePageArena {
+ public:
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+  HugePageArena();
+  ~HugePageArena();
+
+  char* Allocate(size_t size);
+  void Deallocate(char* p, size_t size);
+
+  // Bytes a block of the given size really occupies.
+  static size_t UsableSize(size_t size);
+
+  // Map size bytes, rounded up to kHugePageSize, on their own huge pages.
+  // For arrays too large for Allocate(), such as hash table buckets.
+  static char* AllocateLarge(size_t size);
+  static void DeallocateLarge(char* p, size_t size);
+
+  // Bytes mapped so far, for small blocks.
+  size_t GetMappedBytes() const;
+
+ private:
+  static const size_t kAlignment = 16;
+  static const size_t kMaxSmallSize = 1024;
+  static const size_t kNumSizeClasses = kMaxSmallSize / kAlignment;
+
+  static size_t SizeClass(size_t size) {
+    return (size + kAlignment - 1) / kAlignment - 1;
+  }
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  mutable port::Mutex mutex_;
+  FreeBlock* free_lists_[kNumSizeClasses];
+  char* alloc_ptr_;
+  size_t alloc_bytes_remaining_;
+  std::vector<char*> regions_;
+
+  // No copying allowed
+  HugePageArena(const HugePageArena&);
+  void operator=(const HugePageArena&);
+};
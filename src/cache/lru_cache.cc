@@ -14,17 +14,20 @@
 #include <stdlib.h>
 #include <string>
 
-LRUHandleTable::LRUHandleTable() : list_(nullptr), length_(0), elems_(0) {
+#include "async_deleter.h"
+
+LRUHandleTable::LRUHandleTable(HugePageArena* arena)
+    : list_(nullptr), length_(0), elems_(0), arena_(arena) {
   Resize();
 }
 
 LRUHandleTable::~LRUHandleTable() {
-  ApplyToAllCacheEntries([](LRUHandle* h) {
+  ApplyToAllCacheEntries([this](LRUHandle* h) {
     if (!h->HasRefs()) {
-      h->Free();
+      h->Free(arena_);
     }
   });
-  delete[] list_;
+  FreeBuckets(list_, length_);
 }
 
 LRUHandle* LRUHandleTable::Lookup(const Slice& key, uint32_t hash) {
@@ -67,7 +70,7 @@ void LRUHandleTable::PrintTableInfo() const {
 		fprintf(stdout, "bucket: %d \n", i);
 		while (tmp_head) {
 			fprintf(stdout, "%-20s %-20s %-20d %-20lu %-20d %-20u %-20u\n",
-							tmp_head->key_data,
+							tmp_head->key().ToString().c_str(),
 							strcmp(static_cast<char*> (tmp_head->value), "") ? "-":"val" ,
 							tmp_head->InCache(),
 							tmp_head->charge,
@@ -102,7 +105,7 @@ void LRUHandleTable::Resize() {
   while (new_length < elems_ * 1.5) {
     new_length *= 2;
   }
-  LRUHandle** new_list = new LRUHandle*[new_length];
+  LRUHandle** new_list = AllocateBuckets(new_length);
   memset(new_list, 0, sizeof(new_list[0]) * new_length);
   uint32_t count = 0;
   for (uint32_t i = 0; i < length_; i++) {
@@ -118,31 +121,63 @@ void LRUHandleTable::Resize() {
     }
   }
   assert(elems_ == count);
-  delete[] list_;
+  FreeBuckets(list_, length_);
   list_ = new_list;
   length_ = new_length;
 }
 
+LRUHandle** LRUHandleTable::AllocateBuckets(uint32_t length) {
+  size_t bytes = sizeof(LRUHandle*) * length;
+  if (arena_ != nullptr && bytes >= HugePageArena::kHugePageSize) {
+    return reinterpret_cast<LRUHandle**>(HugePageArena::AllocateLarge(bytes));
+  }
+  return new LRUHandle*[length];
+}
+
+void LRUHandleTable::FreeBuckets(LRUHandle** list, uint32_t length) {
+  size_t bytes = sizeof(LRUHandle*) * length;
+  if (arena_ != nullptr && bytes >= HugePageArena::kHugePageSize) {
+    HugePageArena::DeallocateLarge(reinterpret_cast<char*>(list), bytes);
+  } else {
+    delete[] list;
+  }
+}
+
 LRUCacheShard::LRUCacheShard(size_t capacity, bool strict_capacity_limit,
                              double high_pri_pool_ratio,
-                             bool use_adaptive_mutex)
+                             bool use_adaptive_mutex,
+                             AsyncDeleter* async_deleter,
+                             bool metadata_charged,
+                             bool use_huge_page_arena,
+                             const NamespaceGenerations* namespaces)
     : capacity_(0),
       high_pri_pool_usage_(0),
       strict_capacity_limit_(strict_capacity_limit),
       high_pri_pool_ratio_(high_pri_pool_ratio),
       high_pri_pool_capacity_(0),
+      async_deleter_(async_deleter),
+      namespaces_(namespaces),
+      metadata_charged_(metadata_charged),
+      arena_(use_huge_page_arena ? new HugePageArena() : nullptr),
+      table_(arena_.get()),
       usage_(0),
       lru_usage_(0),
+      metadata_usage_(0),
+      table_charge_(0),
+      reserved_usage_(0),
       mutex_(use_adaptive_mutex) {
   // Make empty circular linked list
   lru_.next = &lru_;
   lru_.prev = &lru_;
   lru_low_pri_ = &lru_;
+  if (metadata_charged_) {
+    UpdateTableCharge();
+  }
   SetCapacity(capacity);
 }
 
 void LRUCacheShard::EraseUnRefEntries() {
-  std::vector<LRUHandle*> last_reference_list;
+  ScopedThreadLocal<LRUHandleList> last_reference_list;
   {
     MutexLock l(&mutex_);
     while (lru_.next != &lru_) {
@@ -152,14 +187,13 @@ void LRUCacheShard::EraseUnRefEntries() {
       LRU_Remove(old);
       table_.Remove(old->key(), old->hash);
       old->SetInCache(false);
-      usage_ -= old->charge;
-      last_reference_list.emplace_back(old);
+      usage_ -= old->total_charge;
+      metadata_usage_ -= old->total_charge - old->charge;
+      last_reference_list->emplace_back(old);
     }
   }
 
-  for (auto entry : last_reference_list) {
-    entry->Free();
-  }
+  FreeEntries(*last_reference_list);
 }
 
 void LRUCacheShard::ApplyToAllCacheEntries(void (*callback)(void*, size_t),
@@ -177,6 +211,20 @@ void LRUCacheShard::ApplyToAllCacheEntries(void (*callback)(void*, size_t),
   }
 }
 
+void LRUCacheShard::ApplyToAllEntries(const Cache::EntryCallback& callback,
+                                      size_t entries_per_lock) {
+  uint32_t cursor = 0;
+  bool more = true;
+  while (more) {
+    MutexLock l(&mutex_);
+    more = table_.ApplyToSomeEntries(
+        [&](LRUHandle* h) {
+          return IsStale(h) || callback(h->key(), h->value, h->charge);
+        },
+        entries_per_lock, &cursor);
+  }
+}
+
 void LRUCacheShard::TEST_GetLRUList(LRUHandle** lru, LRUHandle** lru_low_pri) {
   MutexLock l(&mutex_);
   *lru = &lru_;
@@ -208,10 +256,10 @@ void LRUCacheShard::LRU_Remove(LRUHandle* e) {
   e->next->prev = e->prev;
   e->prev->next = e->next;
   e->prev = e->next = nullptr;
-  lru_usage_ -= e->charge;
+  lru_usage_ -= e->total_charge;
   if (e->InHighPriPool()) {
-    assert(high_pri_pool_usage_ >= e->charge);
-    high_pri_pool_usage_ -= e->charge;
+    assert(high_pri_pool_usage_ >= e->total_charge);
+    high_pri_pool_usage_ -= e->total_charge;
   }
 }
 
@@ -225,7 +273,7 @@ void LRUCacheShard::LRU_Insert(LRUHandle* e) {
     e->prev->next = e;
     e->next->prev = e;
     e->SetInHighPriPool(true);
-    high_pri_pool_usage_ += e->charge;
+    high_pri_pool_usage_ += e->total_charge;
     MaintainPoolSize();
   } else {
     // Insert "e" to the head of low-pri pool. Note that when
@@ -237,7 +285,7 @@ void LRUCacheShard::LRU_Insert(LRUHandle* e) {
     e->SetInHighPriPool(false);
     lru_low_pri_ = e;
   }
-  lru_usage_ += e->charge;
+  lru_usage_ += e->total_charge;
 }
 
 void LRUCacheShard::MaintainPoolSize() {
@@ -246,47 +294,87 @@ void LRUCacheShard::MaintainPoolSize() {
     lru_low_pri_ = lru_low_pri_->next;
     assert(lru_low_pri_ != &lru_);
     lru_low_pri_->SetInHighPriPool(false);
-    high_pri_pool_usage_ -= lru_low_pri_->charge;
+    high_pri_pool_usage_ -= lru_low_pri_->total_charge;
   }
 }
 
-void LRUCacheShard::EvictFromLRU(size_t charge,
-                                 std::vector<LRUHandle*>* deleted) {
-  while ((usage_ + charge) > capacity_ && lru_.next != &lru_) {
+void LRUCacheShard::EvictFromLRU(size_t charge, LRUHandleList* deleted) {
+  while (UsageWithReservations() + charge > capacity_ && lru_.next != &lru_) {
     LRUHandle* old = lru_.next;
     // LRU list contains only elements which can be evicted
     assert(old->InCache() && !old->HasRefs());
     LRU_Remove(old);
     table_.Remove(old->key(), old->hash);
     old->SetInCache(false);
-    usage_ -= old->charge;
+    usage_ -= old->total_charge;
+    metadata_usage_ -= old->total_charge - old->charge;
     deleted->emplace_back(old);
   }
 }
 
+void LRUCacheShard::FreeEntries(const LRUHandleList& entries) {
+  if (entries.empty()) {
+    return;
+  }
+  if (async_deleter_ == nullptr) {
+    for (auto entry : entries) {
+      entry->Free(arena_.get());
+    }
+    return;
+  }
+  AsyncDeleter::Batch* batch = new AsyncDeleter::Batch();
+  for (auto entry : entries) {
+    assert(entry->refs == 0);
+    batch->Add(entry->deleter, entry->key(), entry->value,
+               entry->total_charge, reinterpret_cast<char*>(entry),
+               arena_.get(), entry->AllocSize());
+  }
+  async_deleter_->Submit(batch);
+}
+
+void LRUCacheShard::FreeEntry(LRUHandle* e) {
+  if (async_deleter_ == nullptr) {
+    e->Free(arena_.get());
+    return;
+  }
+  AsyncDeleter::Batch* batch = new AsyncDeleter::Batch();
+  batch->Add(e->deleter, e->key(), e->value, e->total_charge,
+             reinterpret_cast<char*>(e), arena_.get(), e->AllocSize());
+  async_deleter_->Submit(batch);
+}
+
+void LRUCacheShard::UpdateTableCharge() {
+  size_t table_memory = table_.GetTableMemory();
+  usage_ += table_memory - table_charge_;
+  metadata_usage_ += table_memory - table_charge_;
+  table_charge_ = table_memory;
+}
+
 void LRUCacheShard::SetCapacity(size_t capacity) {
-  std::vector<LRUHandle*> last_reference_list;
+  ScopedThreadLocal<LRUHandleList> last_reference_list;
   {
     MutexLock l(&mutex_);
     capacity_ = capacity;
     high_pri_pool_capacity_ = capacity_ * high_pri_pool_ratio_;
-    EvictFromLRU(0, &last_reference_list);
+    EvictFromLRU(0, last_reference_list.get());
   }
 
   // Free the entries outside of mutex for performance reasons
-  for (auto entry : last_reference_list) {
-    entry->Free();
-  }
+  FreeEntries(*last_reference_list);
 }
 
 void LRUCacheShard::SetStrictCapacityLimit(bool strict_capacity_limit) {
   MutexLock l(&mutex_);
-  strict_capacity_limit_ = strict_capacity_limit;
+  strict_capacity_limit_.store(strict_capacity_limit,
+                               std::memory_order_relaxed);
 }
 
-Cache::Handle* LRUCacheShard::Lookup(const Slice& key, uint32_t hash) {
-  MutexLock l(&mutex_);
+LRUHandle* LRUCacheShard::LookupLocked(const Slice& key, uint32_t hash) {
+  mutex_.AssertHeld();
   LRUHandle* e = table_.Lookup(key, hash);
+  if (e != nullptr && IsStale(e)) {
+    return nullptr;
+  }
   if (e != nullptr) {
     assert(e->InCache());
     if (!e->HasRefs()) {
@@ -296,7 +384,50 @@ Cache::Handle* LRUCacheShard::Lookup(const Slice& key, uint32_t hash) {
     e->Ref();
     e->SetHit();
   }
-  return reinterpret_cast<Cache::Handle*>(e);
+  return e;
+}
+
+Cache::Handle* LRUCacheShard::Lookup(const Slice& key, uint32_t hash) {
+  MutexLock l(&mutex_);
+  return reinterpret_cast<Cache::Handle*>(LookupLocked(key, hash));
+}
+
+void LRUCacheShard::MultiLookup(const Slice* keys, const uint32_t* hashes,
+                                const size_t* indexes, size_t n,
+                                Cache::Handle** handles) {
+  const size_t kDistance = kMultiLookupPrefetchDistance;
+  MutexLock l(&mutex_);
+  for (size_t i = 0; i < n && i < 2 * kDistance; i++) {
+    table_.PrefetchBucket(hashes[indexes[i]]);
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (i + 2 * kDistance < n) {
+      table_.PrefetchBucket(hashes[indexes[i + 2 * kDistance]]);
+    }
+    if (i + kDistance < n) {
+      table_.PrefetchEntry(hashes[indexes[i + kDistance]]);
+    }
+    size_t k = indexes[i];
+    handles[k] =
+        reinterpret_cast<Cache::Handle*>(LookupLocked(keys[k], hashes[k]));
+  }
+}
+
+bool LRUCacheShard::Get(const Slice& key, uint32_t hash,
+                        const Cache::ReadCallback& reader) {
+  MutexLock l(&mutex_);
+  LRUHandle* e = table_.Lookup(key, hash);
+  if (e == nullptr || IsStale(e)) {
+    return false;
+  }
+  assert(e->InCache());
+  e->SetHit();
+  if (!e->HasRefs()) {
+    LRU_Remove(e);
+    LRU_Insert(e);
+  }
+  reader(e->value, e->charge);
+  return true;
 }
 
 bool LRUCacheShard::Ref(Cache::Handle* h) {
@@ -325,7 +456,9 @@ bool LRUCacheShard::Release(Cache::Handle* handle, bool force_erase) {
     MutexLock l(&mutex_);
     last_reference = e->Unref();
     if (last_reference && e->InCache()) {
-      // The item is still in cache, and nobody else holds a reference to it
+      // The item is still in cache, and nobody else holds a reference to it.
+      // Reservations are left out: the LRU list may not have been trimmed
+      // for them yet, the next insert does that.
       if (usage_ > capacity_ || force_erase) {
         // The LRU list must be empty since the cache is full
         assert(lru_.next == &lru_ || force_erase);
@@ -339,93 +472,152 @@ bool LRUCacheShard::Release(Cache::Handle* handle, bool force_erase) {
       }
     }
     if (last_reference) {
-      usage_ -= e->charge;
+      usage_ -= e->total_charge;
+      metadata_usage_ -= e->total_charge - e->charge;
     }
   }
 
   // Free the entry here outside of mutex for performance reasons
   if (last_reference) {
-    e->Free();
+    FreeEntry(e);
   }
   return last_reference;
 }
 
-bool LRUCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
-                             size_t charge,
-                             void (*deleter)(const Slice& key, void* value),
-                             Cache::Handle** handle, Cache::Priority priority) {
-  // Allocate the memory here outside of the mutex
-  // If the cache is full, we'll have to release it
-  // It shouldn't happen very often though.
+LRUHandle* LRUCacheShard::CreateHandle(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value), Cache::Priority priority) {
+  const size_t handle_size = sizeof(LRUHandle) - 1 + key.size();
   LRUHandle* e = reinterpret_cast<LRUHandle*>(
-      new char[sizeof(LRUHandle) - 1 + key.size()]);
-  bool s = true;
-
-  std::vector<LRUHandle*> last_reference_list;
-
+      arena_ ? arena_->Allocate(handle_size) : new char[handle_size]);
   e->value = value;
   e->deleter = deleter;
   e->charge = charge;
+  e->total_charge = charge;
+  if (metadata_charged_) {
+    e->total_charge += arena_ ? HugePageArena::UsableSize(handle_size)
+                              : port::MallocUsableSize(e, handle_size);
+  }
   e->key_length = key.size();
   e->flags = 0;
   e->hash = hash;
   e->refs = 0;
+  e->generation = namespaces_ != nullptr ? namespaces_->Current(key) : 0;
   e->next = e->prev = nullptr;
   e->SetInCache(true);
   e->SetPriority(priority);
   memcpy(e->key_data, key.data(), key.size());
+  return e;
+}
 
-  {
-    MutexLock l(&mutex_);
+bool LRUCacheShard::InsertLocked(LRUHandle* e, Cache::Handle** handle,
+                                 LRUHandleList* deleted) {
+  mutex_.AssertHeld();
+  bool s = true;
 
-    // Free the space following strict LRU policy until enough space
-    // is freed or the lru list is empty
-    EvictFromLRU(charge, &last_reference_list);
+  // Free the space following strict LRU policy until enough space
+  // is freed or the lru list is empty
+  EvictFromLRU(e->total_charge, deleted);
 
-    if ((usage_ + charge) > capacity_ &&
-        (strict_capacity_limit_ || handle == nullptr)) {
-      if (handle == nullptr) {
-        // Don't insert the entry but still return ok, as if the entry inserted
-        // into cache and get evicted immediately.
-        e->SetInCache(false);
-        last_reference_list.emplace_back(e);
+  if (UsageWithReservations() + e->total_charge > capacity_ &&
+      (strict_capacity_limit_.load(std::memory_order_relaxed) ||
+       handle == nullptr)) {
+    if (handle == nullptr) {
+      // Don't insert the entry but still return ok, as if the entry inserted
+      // into cache and get evicted immediately.
+      e->SetInCache(false);
+      deleted->emplace_back(e);
+    } else {
+      if (arena_) {
+        arena_->Deallocate(reinterpret_cast<char*>(e), e->AllocSize());
       } else {
         delete[] reinterpret_cast<char*>(e);
-        *handle = nullptr;
-        s = false;
-      }
-    } else {
-      // Insert into the cache. Note that the cache might get larger than its
-      // capacity if not enough space was freed up.
-      LRUHandle* old = table_.Insert(e);
-      usage_ += e->charge;
-      if (old != nullptr) {
-        assert(old->InCache());
-        old->SetInCache(false);
-        if (!old->HasRefs()) {
-          // old is on LRU because it's in cache and its reference count is 0
-          LRU_Remove(old);
-          usage_ -= old->charge;
-          last_reference_list.emplace_back(old);
-        }
       }
-      if (handle == nullptr) {
-        LRU_Insert(e);
-      } else {
-        e->Ref();
-        *handle = reinterpret_cast<Cache::Handle*>(e);
+      *handle = nullptr;
+      s = false;
+    }
+  } else {
+    // Insert into the cache. Note that the cache might get larger than its
+    // capacity if not enough space was freed up.
+    LRUHandle* old = table_.Insert(e);
+    usage_ += e->total_charge;
+    metadata_usage_ += e->total_charge - e->charge;
+    if (old != nullptr) {
+      assert(old->InCache());
+      old->SetInCache(false);
+      if (!old->HasRefs()) {
+        // old is on LRU because it's in cache and its reference count is 0
+        LRU_Remove(old);
+        usage_ -= old->total_charge;
+        metadata_usage_ -= old->total_charge - old->charge;
+        deleted->emplace_back(old);
       }
     }
+    if (handle == nullptr) {
+      LRU_Insert(e);
+    } else {
+      e->Ref();
+      *handle = reinterpret_cast<Cache::Handle*>(e);
+    }
+    if (old == nullptr && metadata_charged_) {
+      // A new key may have grown the table; make room for it as well.
+      UpdateTableCharge();
+      EvictFromLRU(0, deleted);
+    }
   }
+  return s;
+}
 
-  // Free the entries here outside of mutex for performance reasons
-  for (auto entry : last_reference_list) {
-    entry->Free();
+bool LRUCacheShard::Insert(const Slice& key, uint32_t hash, void* value,
+                             size_t charge,
+                             void (*deleter)(const Slice& key, void* value),
+                             Cache::Handle** handle, Cache::Priority priority) {
+  // Allocate the memory here outside of the mutex
+  // If the cache is full, we'll have to release it
+  // It shouldn't happen very often though.
+  LRUHandle* e = CreateHandle(key, hash, value, charge, deleter, priority);
+  bool s;
+
+  ScopedThreadLocal<LRUHandleList> last_reference_list;
+  {
+    MutexLock l(&mutex_);
+    s = InsertLocked(e, handle, last_reference_list.get());
   }
 
+  // Free the entries here outside of mutex for performance reasons
+  FreeEntries(*last_reference_list);
+
   return s;
 }
 
+void LRUCacheShard::MultiInsert(const Slice* keys, const uint32_t* hashes,
+                                void* const* values, const size_t* charges,
+                                const size_t* indexes, size_t n,
+                                void (*deleter)(const Slice& key, void* value),
+                                Cache::Priority priority) {
+  std::vector<LRUHandle*> entries(n);
+  size_t total_charge = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t k = indexes[i];
+    entries[i] = CreateHandle(keys[k], hashes[k], values[k], charges[k],
+                              deleter, priority);
+    total_charge += entries[i]->total_charge;
+  }
+
+  ScopedThreadLocal<LRUHandleList> last_reference_list;
+  {
+    MutexLock l(&mutex_);
+    // Make room for the whole batch in one pass. InsertLocked() only evicts
+    // again if the batch is larger than the shard.
+    EvictFromLRU(total_charge, last_reference_list.get());
+    for (LRUHandle* e : entries) {
+      InsertLocked(e, nullptr, last_reference_list.get());
+    }
+  }
+
+  FreeEntries(*last_reference_list);
+}
+
 void LRUCacheShard::Erase(const Slice& key, uint32_t hash) {
   LRUHandle* e;
   bool last_reference = false;
@@ -438,7 +630,8 @@ void LRUCacheShard::Erase(const Slice& key, uint32_t hash) {
       if (!e->HasRefs()) {
         // The entry is in LRU since it's in hash and has no external references
         LRU_Remove(e);
-        usage_ -= e->charge;
+        usage_ -= e->total_charge;
+        metadata_usage_ -= e->total_charge - e->charge;
         last_reference = true;
       }
     }
@@ -447,19 +640,51 @@ void LRUCacheShard::Erase(const Slice& key, uint32_t hash) {
   // Free the entry here outside of mutex for performance reasons
   // last_reference will only be true if e != nullptr
   if (last_reference) {
-    e->Free();
+    FreeEntry(e);
   }
 }
 
 size_t LRUCacheShard::GetUsage() const {
-  MutexLock l(&mutex_);
-  return usage_;
+  return UsageWithReservations();
 }
 
 size_t LRUCacheShard::GetPinnedUsage() const {
-  MutexLock l(&mutex_);
-  assert(usage_ >= lru_usage_);
-  return usage_ - lru_usage_;
+  size_t usage = UsageWithReservations();
+  size_t unpinned = lru_usage_ + table_charge_;
+  // The counters are read one by one, so they may disagree for a moment.
+  return usage > unpinned ? usage - unpinned : 0;
+}
+
+size_t LRUCacheShard::GetMetadataUsage() const {
+  return metadata_usage_;
+}
+
+bool LRUCacheShard::Reserve(size_t charge) {
+  if (!strict_capacity_limit_.load(std::memory_order_relaxed)) {
+    reserved_usage_.fetch_add(charge, std::memory_order_relaxed);
+    return true;
+  }
+  ScopedThreadLocal<LRUHandleList> last_reference_list;
+  bool s = false;
+  {
+    MutexLock l(&mutex_);
+    EvictFromLRU(charge, last_reference_list.get());
+    if (UsageWithReservations() + charge <= capacity_) {
+      reserved_usage_.fetch_add(charge, std::memory_order_relaxed);
+      s = true;
+    }
+  }
+  FreeEntries(*last_reference_list);
+  return s;
+}
+
+void LRUCacheShard::Unreserve(size_t charge) {
+  assert(reserved_usage_.load(std::memory_order_relaxed) >= charge);
+  reserved_usage_.fetch_sub(charge, std::memory_order_relaxed);
+}
+
+size_t LRUCacheShard::GetReservedUsage() const {
+  return reserved_usage_.load(std::memory_order_relaxed);
 }
 
 std::string LRUCacheShard::GetPrintableOptions() const {
@@ -500,7 +725,7 @@ void LRUCacheShard::PrintCacheInfo() {
 	LRUHandle* tmp_high = lru->next;
 	while (tmp_high != lru) {
 		fprintf(stdout, "%-20s %-20s %-20d %-20lu %-20d %-20u %-20u\n",
-						tmp_high->key_data,
+						tmp_high->key().ToString().c_str(),
 						strcmp(static_cast<char*> (tmp_high->value), "") ? "-":"val" ,
 						tmp_high->InCache(),
 						tmp_high->charge,
@@ -515,9 +740,10 @@ void LRUCacheShard::PrintCacheInfo() {
 LRUCache::LRUCache(size_t capacity, int num_shard_bits,
                    bool strict_capacity_limit, double high_pri_pool_ratio,
                    std::shared_ptr<MemoryAllocator> allocator,
-                   bool use_adaptive_mutex)
+                   bool use_adaptive_mutex, int async_deleter_threads,
+                   bool metadata_charged, bool use_huge_page_arena)
     : ShardedCache(capacity, num_shard_bits, strict_capacity_limit,
-                   std::move(allocator)) {
+                   std::move(allocator), async_deleter_threads) {
   num_shards_ = 1 << num_shard_bits;
   shards_ = reinterpret_cast<LRUCacheShard*>(
       port::cacheline_aligned_alloc(sizeof(LRUCacheShard) * num_shards_));
@@ -525,11 +751,14 @@ LRUCache::LRUCache(size_t capacity, int num_shard_bits,
   for (int i = 0; i < num_shards_; i++) {
     new (&shards_[i])
         LRUCacheShard(per_shard, strict_capacity_limit, high_pri_pool_ratio,
-            use_adaptive_mutex);
+            use_adaptive_mutex, async_deleter(), metadata_charged,
+            use_huge_page_arena, namespaces());
+    shards_[i].SetMutexProfileName(i);
   }
 }
 
 LRUCache::~LRUCache() {
+  ShutdownAsyncDeleter();
   if (shards_ != nullptr) {
     assert(num_shards_ > 0);
     for (int i = 0; i < num_shards_; i++) {
@@ -591,31 +820,33 @@ double LRUCache::GetHighPriPoolRatio() {
 }
 
 std::shared_ptr<Cache> NewLRUCache(const LRUCacheOptions& cache_opts) {
-  return NewLRUCache(cache_opts.capacity, cache_opts.num_shard_bits,
-                     cache_opts.strict_capacity_limit,
-                     cache_opts.high_pri_pool_ratio,
-                     cache_opts.memory_allocator,
-                     cache_opts.use_adaptive_mutex);
-}
-
-std::shared_ptr<Cache> NewLRUCache(
-    size_t capacity, int num_shard_bits, bool strict_capacity_limit,
-    double high_pri_pool_ratio,
-    std::shared_ptr<MemoryAllocator> memory_allocator,
-    bool use_adaptive_mutex) {
+  int num_shard_bits = cache_opts.num_shard_bits;
   if (num_shard_bits >= 20) {
     return nullptr;  // the cache cannot be sharded into too many fine pieces
   }
-  if (high_pri_pool_ratio < 0.0 || high_pri_pool_ratio > 1.0) {
+  if (cache_opts.high_pri_pool_ratio < 0.0 ||
+      cache_opts.high_pri_pool_ratio > 1.0) {
     // invalid high_pri_pool_ratio
     return nullptr;
   }
   if (num_shard_bits < 0) {
-    num_shard_bits = GetDefaultCacheShardBits(capacity);
+    num_shard_bits = GetDefaultCacheShardBits(cache_opts.capacity);
   }
-  return std::make_shared<LRUCache>(capacity, num_shard_bits,
-                                    strict_capacity_limit, high_pri_pool_ratio,
-                                    std::move(memory_allocator),
-                                    use_adaptive_mutex);
+  return std::make_shared<LRUCache>(
+      cache_opts.capacity, num_shard_bits, cache_opts.strict_capacity_limit,
+      cache_opts.high_pri_pool_ratio, cache_opts.memory_allocator,
+      cache_opts.use_adaptive_mutex, cache_opts.async_deleter_threads,
+      cache_opts.metadata_charged, cache_opts.use_huge_page_arena);
+}
+
+std::shared_ptr<Cache> NewLRUCache(
+    size_t capacity, int num_shard_bits, bool strict_capacity_limit,
+    double high_pri_pool_ratio,
+    std::shared_ptr<MemoryAllocator> memory_allocator,
+    bool use_adaptive_mutex) {
+  return NewLRUCache(LRUCacheOptions(capacity, num_shard_bits,
+                                     strict_capacity_limit, high_pri_pool_ratio,
+                                     std::move(memory_allocator),
+                                     use_adaptive_mutex));
 }
 
@@ -11,6 +11,8 @@
 #include <string>
 #include <vector>
 
+#include "autovector.h"
+#include "huge_page_arena.h"
 #include "sharded_cache.h"
 
 #include "port.h"
@@ -51,11 +53,16 @@ struct LRUHandle {
   LRUHandle* next;
   LRUHandle* prev;
   size_t charge;  // TODO(opt): Only allow uint32_t?
+  // What the entry costs against the capacity: charge, plus the handle and
+  // key bytes if the cache charges metadata.
+  size_t total_charge;
   size_t key_length;
   // The hash of key(). Used for fast sharding and comparisons.
   uint32_t hash;
   // The number of external refs to this entry. The cache itself is not counted.
   uint32_t refs;
+  // The generation of the key's namespace when the entry was inserted.
+  uint32_t generation;
 
   enum Flags : uint8_t {
     // Whether this entry is referenced by the hash table.
@@ -75,6 +82,9 @@ struct LRUHandle {
 
   Slice key() const { return Slice(key_data, key_length); }
 
+  // Bytes allocated for this handle and its key.
+  size_t AllocSize() const { return sizeof(LRUHandle) - 1 + key_length; }
+
   // Increase the reference count by 1.
   void Ref() { refs++; }
 
@@ -119,15 +129,25 @@ struct LRUHandle {
 
   void SetHit() { flags |= HAS_HIT; }
 
-  void Free() {
+  // arena is the shard's HugePageArena, or nullptr if the handle was
+  // allocated with new[].
+  void Free(HugePageArena* arena) {
     assert(refs == 0);
     if (deleter) {
       (*deleter)(key(), value);
     }
-    delete[] reinterpret_cast<char*>(this);
+    if (arena != nullptr) {
+      arena->Deallocate(reinterpret_cast<char*>(this), AllocSize());
+    } else {
+      delete[] reinterpret_cast<char*>(this);
+    }
   }
 };
 
+// Entries whose last reference was dropped under the shard mutex. They are
+// freed after the mutex is released.
+typedef autovector<LRUHandle*> LRUHandleList;
+
 // We provide our own simple hash table since it removes a whole bunch
 // of porting hacks and is also faster than some of the built-in hash
 // table implementations in some of the compiler/runtime combinations
@@ -135,7 +155,10 @@ struct LRUHandle {
 // 4.4.3's builtin hashtable.
 class LRUHandleTable {
  public:
-  LRUHandleTable();
+  // If arena is non-null, entries still in the table at destruction are
+  // returned to it, and bucket arrays of at least a huge page are mapped on
+  // huge pages.
+  explicit LRUHandleTable(HugePageArena* arena = nullptr);
   ~LRUHandleTable();
 
   LRUHandle* Lookup(const Slice& key, uint32_t hash);
@@ -143,6 +166,21 @@ class LRUHandleTable {
   LRUHandle* Remove(const Slice& key, uint32_t hash);
   void PrintTableInfo() const;
 
+  // Pull the bucket for hash, or the first entry in it, into the CPU cache
+  // ahead of a Lookup().
+  void PrefetchBucket(uint32_t hash) const {
+    PREFETCH(&list_[hash & (length_ - 1)], 0, 3);
+  }
+  void PrefetchEntry(uint32_t hash) const {
+    LRUHandle* h = list_[hash & (length_ - 1)];
+    if (h != nullptr) {
+      PREFETCH(h, 1, 3);
+    }
+  }
+
+  // Bytes used by the bucket array.
+  size_t GetTableMemory() const { return length_ * sizeof(LRUHandle*); }
+
   template <typename T>
   void ApplyToAllCacheEntries(T func) {
     for (uint32_t i = 0; i < length_; i++) {
@@ -156,7 +194,48 @@ class LRUHandleTable {
     }
   }
 
+  // Call func on the entries of the buckets from *cursor on until about
+  // max_entries were visited, and advance *cursor. Returns false once func
+  // returned false or the last bucket was visited.
+  //
+  // Buckets are visited in bit-reversed index order, as Redis' SCAN does:
+  // when Resize() doubles the table, a bucket's entries move to buckets that
+  // come next in that order, so a cursor kept across a Resize() still visits
+  // each entry that stays in the table exactly once.
+  template <typename T>
+  bool ApplyToSomeEntries(T func, size_t max_entries, uint32_t* cursor) {
+    const uint32_t mask = length_ - 1;
+    uint32_t v = *cursor;
+    size_t visited = 0;
+    do {
+      LRUHandle* h = list_[v & mask];
+      while (h != nullptr) {
+        auto n = h->next_hash;
+        assert(h->InCache());
+        if (!func(h)) {
+          return false;
+        }
+        visited++;
+        h = n;
+      }
+      v = ReverseBits(ReverseBits(v | ~mask) + 1);
+      if (v == 0) {
+        return false;
+      }
+    } while (visited < max_entries);
+    *cursor = v;
+    return true;
+  }
+
  private:
+  static uint32_t ReverseBits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+    v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+    v = ((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+    return (v >> 16) | (v << 16);
+  }
+
   // Return a pointer to slot that points to a cache entry that
   // matches key/hash.  If there is no such cache entry, return a
   // pointer to the trailing slot in the corresponding linked list.
@@ -164,20 +243,54 @@ class LRUHandleTable {
 
   void Resize();
 
+  LRUHandle** AllocateBuckets(uint32_t length);
+  void FreeBuckets(LRUHandle** list, uint32_t length);
+
   // The table consists of an array of buckets where each bucket is
   // a linked list of cache entries that hash into the bucket.
   LRUHandle** list_;
   uint32_t length_;
   uint32_t elems_;
+  HugePageArena* const arena_;
+};
+
+// A counter that is only written under a lock but read without one. Loads
+// and stores are relaxed atomics, so updates compile to plain moves rather
+// than locked read-modify-writes, and readers see a recent value.
+class RelaxedCounter {
+ public:
+  explicit RelaxedCounter(size_t value) : value_(value) {}
+
+  operator size_t() const { return value_.load(std::memory_order_relaxed); }
+
+  RelaxedCounter& operator=(size_t value) {
+    value_.store(value, std::memory_order_relaxed);
+    return *this;
+  }
+  RelaxedCounter& operator+=(size_t delta) { return *this = *this + delta; }
+  RelaxedCounter& operator-=(size_t delta) { return *this = *this - delta; }
+
+ private:
+  std::atomic<size_t> value_;
 };
 
 // A single shard of sharded cache.
 class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
  public:
   LRUCacheShard(size_t capacity, bool strict_capacity_limit,
-                double high_pri_pool_ratio, bool use_adaptive_mutex);
+                double high_pri_pool_ratio, bool use_adaptive_mutex,
+                AsyncDeleter* async_deleter = nullptr,
+                bool metadata_charged = false,
+                bool use_huge_page_arena = false,
+                const NamespaceGenerations* namespaces = nullptr);
   virtual ~LRUCacheShard() override = default;
 
+  // Reports the contention of mutex_ as that of this shard index, in builds
+  // that profile it (see port::GetMutexContention()).
+  void SetMutexProfileName(int shard) {
+    mutex_.SetProfileName("LRUCacheShard::mutex_", shard);
+  }
+
   // Separate from constructor so caller can easily make an array of LRUCache
   // if current usage is more than new capacity, the function will attempt to
   // free the needed space
@@ -195,21 +308,47 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
                         void (*deleter)(const Slice& key, void* value),
                         Cache::Handle** handle,
                         Cache::Priority priority) override;
+  // Allocates all handles before taking mutex_, then evicts once for the
+  // total charge and links the batch under one lock hold.
+  virtual void MultiInsert(const Slice* keys, const uint32_t* hashes,
+                           void* const* values, const size_t* charges,
+                           const size_t* indexes, size_t n,
+                           void (*deleter)(const Slice& key, void* value),
+                           Cache::Priority priority) override;
   virtual Cache::Handle* Lookup(const Slice& key, uint32_t hash) override;
+  // Takes mutex_ once for the whole group, and prefetches the buckets and
+  // entries of the keys a few probes ahead.
+  virtual void MultiLookup(const Slice* keys, const uint32_t* hashes,
+                           const size_t* indexes, size_t n,
+                           Cache::Handle** handles) override;
+  // Runs reader under mutex_ and moves the entry to the head of the LRU
+  // list, as Lookup() followed by Release() would.
+  virtual bool Get(const Slice& key, uint32_t hash,
+                   const Cache::ReadCallback& reader) override;
   virtual bool Ref(Cache::Handle* handle) override;
   virtual bool Release(Cache::Handle* handle,
                        bool force_erase = false) override;
   virtual void Erase(const Slice& key, uint32_t hash) override;
 
-  // Although in some platforms the update of size_t is atomic, to make sure
-  // GetUsage() and GetPinnedUsage() work correctly under any platform, we'll
-  // protect them with mutex_.
-
+  // The usage counters are written under mutex_ but read without it, so
+  // these do not contend with lookups. GetPinnedUsage() reads three
+  // counters and may be off by a concurrent update.
   virtual size_t GetUsage() const override;
   virtual size_t GetPinnedUsage() const override;
+  virtual size_t GetMetadataUsage() const override;
+
+  // Reservations are kept in reserved_usage_ outside mutex_, and only the
+  // strict capacity path takes the mutex.
+  virtual bool Reserve(size_t charge) override;
+  virtual void Unreserve(size_t charge) override;
+  virtual size_t GetReservedUsage() const override;
 
   virtual void ApplyToAllCacheEntries(void (*callback)(void*, size_t),
                                       bool thread_safe) override;
+  // Takes mutex_ once per chunk of entries, keeping a table cursor between
+  // chunks.
+  virtual void ApplyToAllEntries(const Cache::EntryCallback& callback,
+                                 size_t entries_per_lock) override;
 
   virtual void EraseUnRefEntries() override;
 
@@ -229,6 +368,31 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
   void LRU_Remove(LRUHandle* e);
   void LRU_Insert(LRUHandle* e);
 
+  // Allocate and fill a handle for a new entry. Called without mutex_.
+  LRUHandle* CreateHandle(const Slice& key, uint32_t hash, void* value,
+                          size_t charge,
+                          void (*deleter)(const Slice& key, void* value),
+                          Cache::Priority priority);
+
+  // Make room for e and link it into the table, as Insert() does. Entries
+  // to free once mutex_ is released are appended to deleted.
+  bool InsertLocked(LRUHandle* e, Cache::Handle** handle,
+                    LRUHandleList* deleted);
+
+  // Lookup() without taking mutex_.
+  LRUHandle* LookupLocked(const Slice& key, uint32_t hash);
+
+  // Whether e's namespace has been erased since e was inserted.
+  bool IsStale(const LRUHandle* e) const {
+    return namespaces_ != nullptr &&
+           namespaces_->IsStale(e->key(), e->generation);
+  }
+
+  // How many probes ahead MultiLookup() prefetches the entry of a key. Its
+  // bucket is prefetched twice as far ahead, so that loading the entry
+  // pointer does not miss.
+  static const size_t kMultiLookupPrefetchDistance = 4;
+
   // Overflow the last entry in high-pri pool to low-pri pool until size of
   // high-pri pool is no larger than the size specify by high_pri_pool_pct.
   void MaintainPoolSize();
@@ -237,7 +401,21 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
   // to hold (usage_ + charge) is freed or the lru list is empty
   // This function is not thread safe - it needs to be executed while
   // holding the mutex_
-  void EvictFromLRU(size_t charge, std::vector<LRUHandle*>* deleted);
+  void EvictFromLRU(size_t charge, LRUHandleList* deleted);
+
+  // usage_ plus reservations, as compared against capacity_.
+  size_t UsageWithReservations() const {
+    return usage_ + reserved_usage_.load(std::memory_order_relaxed);
+  }
+
+  // Free entries whose last reference is gone, either inline or through
+  // async_deleter_. Must be called without holding mutex_.
+  void FreeEntries(const LRUHandleList& entries);
+  void FreeEntry(LRUHandle* e);
+
+  // Charge the growth of the hash table's bucket array since the last call.
+  // Only used when metadata_charged_ is set.
+  void UpdateTableCharge();
 
   // Initialized before use.
   size_t capacity_;
@@ -246,7 +424,8 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
   size_t high_pri_pool_usage_;
 
   // Whether to reject insertion if cache reaches its full capacity.
-  bool strict_capacity_limit_;
+  // Atomic so that Reserve() can check it without mutex_.
+  std::atomic<bool> strict_capacity_limit_;
 
   // Ratio of capacity reserved for high priority cache entries.
   double high_pri_pool_ratio_;
@@ -263,6 +442,19 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
   // Pointer to head of low-pri pool in LRU list.
   LRUHandle* lru_low_pri_;
 
+  // Owned by the LRUCache. nullptr if deleters run inline.
+  AsyncDeleter* async_deleter_;
+
+  // The owning cache's namespace generations, or nullptr.
+  const NamespaceGenerations* namespaces_;
+
+  // Whether handle, key and table memory is charged against capacity_.
+  bool metadata_charged_;
+
+  // Backs entry and bucket memory if use_huge_page_arena is set. Declared
+  // before table_ so it outlives the entries the table frees.
+  std::unique_ptr<HugePageArena> arena_;
+
   // ------------^^^^^^^^^^^^^-----------
   // Not frequently modified data members
   // ------------------------------------
@@ -276,16 +468,30 @@ class ALIGN_AS(CACHE_LINE_SIZE) LRUCacheShard final : public CacheShard {
   // ------------vvvvvvvvvvvvv-----------
   LRUHandleTable table_;
 
+  // The counters below are read without mutex_, and start a cache line of
+  // their own so that readers do not pull in the line mutex_ is on.
+
   // Memory size for entries residing in the cache
-  size_t usage_;
+  ALIGN_AS(CACHE_LINE_SIZE) RelaxedCounter usage_;
 
   // Memory size for entries residing only in the LRU list
-  size_t lru_usage_;
+  RelaxedCounter lru_usage_;
+
+  // Part of usage_ that is metadata: total_charge - charge of the entries in
+  // cache, plus table_charge_.
+  RelaxedCounter metadata_usage_;
+
+  // Bucket array bytes charged to usage_.
+  RelaxedCounter table_charge_;
+
+  // Capacity held by Reserve(). Not part of usage_; the capacity checks
+  // under mutex_ add it in, so growing it needs no lock.
+  std::atomic<size_t> reserved_usage_;
 
   // mutex_ protects the following state.
   // We don't count mutex_ as the cache's internal state so semantically we
   // don't mind mutex_ invoking the non-const actions.
-  mutable port::Mutex mutex_;
+  ALIGN_AS(CACHE_LINE_SIZE) mutable port::Mutex mutex_;
 };
 
 class LRUCache
@@ -297,7 +503,9 @@ class LRUCache
   LRUCache(size_t capacity, int num_shard_bits, bool strict_capacity_limit,
            double high_pri_pool_ratio,
            std::shared_ptr<MemoryAllocator> memory_allocator = nullptr,
-           bool use_adaptive_mutex = kDefaultToAdaptiveMutex);
+           bool use_adaptive_mutex = kDefaultToAdaptiveMutex,
+           int async_deleter_threads = 0, bool metadata_charged = false,
+           bool use_huge_page_arena = false);
   virtual ~LRUCache();
   virtual const char* Name() const override { return "LRUCache"; }
   virtual CacheShard* GetShard(int shard) override;
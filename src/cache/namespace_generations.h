@@ -0,0 +1,74 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#include "slice.h"
+
+// Generation counters behind Cache::EraseNamespace(). A key belongs to the
+// namespace named by its first 8 bytes, read as a native-endian uint64_t;
+// keys shorter than that belong to no namespace.
+//
+// Shards tag each entry with Current(key) when it is inserted, and treat it
+// as a miss once IsStale() reports that its namespace was erased since.
+// Stale entries stay charged until eviction or a replacing Insert() reclaims
+// them.
+//
+// Namespaces share kNumSlots counters, so erasing a namespace may also drop
+// the entries of another namespace that maps to the same slot. Ids are
+// spread over the slots by Fibonacci hashing, so the consecutive ids from
+// NewId() rarely share one.
+class NamespaceGenerations {
+ public:
+  NamespaceGenerations() : erased_(false) {
+    for (size_t i = 0; i < kNumSlots; i++) {
+      slots_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // The generation to tag a new entry for key with.
+  uint32_t Current(const Slice& key) const {
+    if (!erased_.load(std::memory_order_relaxed) || key.size() < 8) {
+      return 0;
+    }
+    uint64_t id;
+    memcpy(&id, key.data(), sizeof(id));
+    return slots_[Slot(id)].load(std::memory_order_acquire);
+  }
+
+  // Whether the entry for key tagged with generation has been erased. Until
+  // the first Erase() this is a single relaxed load.
+  bool IsStale(const Slice& key, uint32_t generation) const {
+    return erased_.load(std::memory_order_relaxed) &&
+           Current(key) != generation;
+  }
+
+  // Make every entry of namespace id inserted so far stale. O(1).
+  void Erase(uint64_t id) {
+    erased_.store(true, std::memory_order_relaxed);
+    slots_[Slot(id)].fetch_add(1, std::memory_order_release);
+  }
+
+ private:
+  static const int kNumSlotBits = 10;
+  static const size_t kNumSlots = size_t{1} << kNumSlotBits;
+
+  // Fibonacci hashing, which spreads consecutive ids over distinct slots.
+  static size_t Slot(uint64_t id) {
+    return static_cast<size_t>((id * 0x9E3779B97F4A7C15ull) >>
+                               (64 - kNumSlotBits));
+  }
+
+  std::atomic<bool> erased_;
+  std::atomic<uint32_t> slots_[kNumSlots];
+
+  // No copying allowed
+  NamespaceGenerations(const NamespaceGenerations&);
+  void operator=(const NamespaceGenerations&);
+};
@@ -10,25 +10,119 @@
 #include "sharded_cache.h"
 
 #include <string>
+#include <vector>
 
+#include "async_deleter.h"
+#include "env.h"
+
+namespace {
+
+// One ApplyToAllEntries() walk. The caller and the helpers it schedules
+// claim shards from next_shard until none are left, then the caller waits
+// for the shards the helpers claimed. A helper that starts after every
+// shard was claimed returns without touching the cache or the callback, so
+// the walk is shared with the helpers through shared_ptr.
+struct ApplyWalk {
+  ApplyWalk(ShardedCache* _cache, int _num_shards,
+            const Cache::EntryCallback* _callback, size_t _entries_per_lock)
+      : cache(_cache),
+        num_shards(_num_shards),
+        callback(_callback),
+        entries_per_lock(_entries_per_lock),
+        next_shard(0),
+        stopped(false),
+        done(0),
+        cv(&mutex) {
+    // Stops the other shards once callback asked to stop.
+    checked_callback = [this](const Slice& key, void* value, size_t charge) {
+      if (stopped.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      if (!(*callback)(key, value, charge)) {
+        stopped.store(true, std::memory_order_relaxed);
+        return false;
+      }
+      return true;
+    };
+  }
+
+  void Run() {
+    int s;
+    while ((s = next_shard.fetch_add(1, std::memory_order_relaxed)) <
+           num_shards) {
+      if (!stopped.load(std::memory_order_relaxed)) {
+        cache->GetShard(s)->ApplyToAllEntries(checked_callback,
+                                              entries_per_lock);
+      }
+      MutexLock l(&mutex);
+      if (++done == num_shards) {
+        cv.SignalAll();
+      }
+    }
+  }
+
+  static void RunHelper(void* arg) {
+    std::shared_ptr<ApplyWalk>* walk =
+        reinterpret_cast<std::shared_ptr<ApplyWalk>*>(arg);
+    (*walk)->Run();
+    delete walk;
+  }
+
+  ShardedCache* const cache;
+  const int num_shards;
+  const Cache::EntryCallback* const callback;
+  Cache::EntryCallback checked_callback;
+  const size_t entries_per_lock;
+  std::atomic<int> next_shard;
+  std::atomic<bool> stopped;
+  port::Mutex mutex;
+  // Shards finished. Guarded by mutex.
+  int done;
+  port::CondVar cv;
+};
+
+}  // namespace
+
+
+const size_t ShardedCache::kAsyncDeleterQueueDivisor;
+const size_t ShardedCache::kMultiLookupBatchSize;
 
 ShardedCache::ShardedCache(size_t capacity, int num_shard_bits,
                            bool strict_capacity_limit,
-                           std::shared_ptr<MemoryAllocator> allocator)
+                           std::shared_ptr<MemoryAllocator> allocator,
+                           int async_deleter_threads)
     : Cache(std::move(allocator)),
       num_shard_bits_(num_shard_bits),
       capacity_(capacity),
       strict_capacity_limit_(strict_capacity_limit),
-      last_id_(1) {}
+      last_id_(1),
+      in_flight_(new InFlightShard[1 << num_shard_bits]) {
+  if (async_deleter_threads > 0) {
+    async_deleter_.reset(new AsyncDeleter(
+        async_deleter_threads, capacity / kAsyncDeleterQueueDivisor));
+  }
+}
+
+// Out of line, where AsyncDeleter is complete.
+ShardedCache::~ShardedCache() {}
+
+void ShardedCache::ShutdownAsyncDeleter() {
+  if (async_deleter_) {
+    async_deleter_->Shutdown();
+  }
+}
 
 void ShardedCache::SetCapacity(size_t capacity) {
   int num_shards = 1 << num_shard_bits_;
   const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
   MutexLock l(&capacity_mutex_);
+  if (async_deleter_) {
+    async_deleter_->SetMaxPendingCharge(capacity / kAsyncDeleterQueueDivisor);
+  }
   for (int s = 0; s < num_shards; s++) {
     GetShard(s)->SetCapacity(per_shard);
   }
-  capacity_ = capacity;
+  capacity_.store(capacity, std::memory_order_relaxed);
 }
 
 void ShardedCache::SetStrictCapacityLimit(bool strict_capacity_limit) {
@@ -37,7 +131,8 @@ void ShardedCache::SetStrictCapacityLimit(bool strict_capacity_limit) {
   for (int s = 0; s < num_shards; s++) {
     GetShard(s)->SetStrictCapacityLimit(strict_capacity_limit);
   }
-  strict_capacity_limit_ = strict_capacity_limit;
+  strict_capacity_limit_.store(strict_capacity_limit,
+                               std::memory_order_relaxed);
 }
 
 bool ShardedCache::Insert(const Slice& key, void* value, size_t charge,
@@ -53,6 +148,144 @@ Cache::Handle* ShardedCache::Lookup(const Slice& key) {
   return GetShard(Shard(hash))->Lookup(key, hash);
 }
 
+bool ShardedCache::Get(const Slice& key, const ReadCallback& reader) {
+  uint32_t hash = HashSlice(key);
+  return GetShard(Shard(hash))->Get(key, hash, reader);
+}
+
+bool ShardedCache::Insert(const HashedKey& key, void* value, size_t charge,
+                          void (*deleter)(const Slice& key, void* value),
+                          Handle** handle, Priority priority) {
+  return GetShard(Shard(key.hash))
+      ->Insert(key.key, key.hash, value, charge, deleter, handle, priority);
+}
+
+Cache::Handle* ShardedCache::Lookup(const HashedKey& key) {
+  return GetShard(Shard(key.hash))->Lookup(key.key, key.hash);
+}
+
+void ShardedCache::Erase(const HashedKey& key) {
+  GetShard(Shard(key.hash))->Erase(key.key, key.hash);
+}
+
+void ShardedCache::MultiLookup(const Slice* keys, size_t n,
+                               Handle** handles) {
+  uint32_t hashes[kMultiLookupBatchSize];
+  size_t indexes[kMultiLookupBatchSize];
+  for (size_t base = 0; base < n; base += kMultiLookupBatchSize) {
+    size_t count = n - base < kMultiLookupBatchSize ? n - base
+                                                    : kMultiLookupBatchSize;
+    for (size_t i = 0; i < count; i++) {
+      hashes[i] = HashSlice(keys[base + i]);
+      indexes[i] = i;
+    }
+    ForEachShardGroup(hashes, indexes, count,
+                      [&](uint32_t shard, const size_t* group, size_t size) {
+                        GetShard(shard)->MultiLookup(keys + base, hashes,
+                                                     group, size,
+                                                     handles + base);
+                      });
+  }
+}
+
+void ShardedCache::MultiInsert(const Slice* keys, void* const* values,
+                               const size_t* charges, size_t n,
+                               void (*deleter)(const Slice& key, void* value),
+                               Priority priority) {
+  std::vector<uint32_t> hashes(n);
+  std::vector<size_t> indexes(n);
+  for (size_t i = 0; i < n; i++) {
+    hashes[i] = HashSlice(keys[i]);
+    indexes[i] = i;
+  }
+  ForEachShardGroup(hashes.data(), indexes.data(), n,
+                    [&](uint32_t shard, const size_t* group, size_t size) {
+                      GetShard(shard)->MultiInsert(keys, hashes.data(),
+                                                   values, charges, group,
+                                                   size, deleter, priority);
+                    });
+}
+
+Cache::Handle* ShardedCache::GetOrCreate(
+    const Slice& key, const CreateCallback& create,
+    void (*deleter)(const Slice& key, void* value), Priority priority) {
+  // Publishes the outcome of this caller's load and wakes its waiters on
+  // every way out of the load, including create() or Insert() throwing, so
+  // a failed loader never leaves waiters blocked on a slot nobody clears.
+  class LoadCompletion {
+   public:
+    LoadCompletion(InFlightShard* in_flight, const std::string& key,
+                   const std::shared_ptr<InFlightLoad>& load)
+        : in_flight_(in_flight), key_(key), load_(load), handle_(nullptr) {}
+
+    ~LoadCompletion() {
+      MutexLock l(&in_flight_->mutex);
+      load_->done = true;
+      load_->ok = handle_ != nullptr;
+      in_flight_->loads.erase(key_);
+      load_->cv.SignalAll();
+    }
+
+    void set_handle(Handle* handle) { handle_ = handle; }
+
+   private:
+    InFlightShard* in_flight_;
+    const std::string& key_;
+    std::shared_ptr<InFlightLoad> load_;
+    Handle* handle_;
+  };
+
+  uint32_t hash = HashSlice(key);
+  CacheShard* shard = GetShard(Shard(hash));
+  InFlightShard& in_flight = in_flight_[Shard(hash)];
+  std::string key_str;
+  while (true) {
+    Handle* handle = shard->Lookup(key, hash);
+    if (handle != nullptr) {
+      return handle;
+    }
+    if (key_str.empty()) {
+      key_str = key.ToString();
+    }
+    std::shared_ptr<InFlightLoad> load;
+    {
+      MutexLock l(&in_flight.mutex);
+      std::shared_ptr<InFlightLoad>& slot = in_flight.loads[key_str];
+      if (slot != nullptr) {
+        load = slot;
+        while (!load->done) {
+          load->cv.Wait();
+        }
+        if (!load->ok) {
+          return nullptr;
+        }
+        // The entry is in the cache now, unless it was evicted already, in
+        // which case this caller becomes the loader.
+        continue;
+      }
+      slot = std::make_shared<InFlightLoad>(&in_flight.mutex);
+      load = slot;
+    }
+    LoadCompletion completion(&in_flight, key_str, load);
+
+    // A load that finished between the lookup above and registering this
+    // one has left the entry behind.
+    handle = shard->Lookup(key, hash);
+    if (handle == nullptr) {
+      size_t charge = 0;
+      void* value = create(key, &charge);
+      if (value != nullptr &&
+          !shard->Insert(key, hash, value, charge, deleter, &handle,
+                         priority)) {
+        (*deleter)(key, value);
+        handle = nullptr;
+      }
+    }
+    completion.set_handle(handle);
+    return handle;
+  }
+}
+
 bool ShardedCache::Ref(Handle* handle) {
   uint32_t hash = GetHash(handle);
   return GetShard(Shard(hash))->Ref(handle);
@@ -72,14 +305,17 @@ uint64_t ShardedCache::NewId() {
   return last_id_.fetch_add(1, std::memory_order_relaxed);
 }
 
+bool ShardedCache::EraseNamespace(uint64_t id) {
+  namespaces_.Erase(id);
+  return true;
+}
+
 size_t ShardedCache::GetCapacity() const {
-  MutexLock l(&capacity_mutex_);
-  return capacity_;
+  return capacity_.load(std::memory_order_relaxed);
 }
 
 bool ShardedCache::HasStrictCapacityLimit() const {
-  MutexLock l(&capacity_mutex_);
-  return strict_capacity_limit_;
+  return strict_capacity_limit_.load(std::memory_order_relaxed);
 }
 
 size_t ShardedCache::GetUsage() const {
@@ -106,6 +342,40 @@ size_t ShardedCache::GetPinnedUsage() const {
   return usage;
 }
 
+void ShardedCache::GetShardUsage(std::vector<size_t>* usage) const {
+  int num_shards = 1 << num_shard_bits_;
+  usage->resize(num_shards);
+  for (int s = 0; s < num_shards; s++) {
+    (*usage)[s] = GetShard(s)->GetUsage();
+  }
+}
+
+size_t ShardedCache::GetMetadataUsage() const {
+  int num_shards = 1 << num_shard_bits_;
+  size_t usage = 0;
+  for (int s = 0; s < num_shards; s++) {
+    usage += GetShard(s)->GetMetadataUsage();
+  }
+  return usage;
+}
+
+bool ShardedCache::Reserve(uint32_t hash, size_t charge) {
+  return GetShard(Shard(hash))->Reserve(charge);
+}
+
+void ShardedCache::Unreserve(uint32_t hash, size_t charge) {
+  GetShard(Shard(hash))->Unreserve(charge);
+}
+
+size_t ShardedCache::GetReservedUsage() const {
+  int num_shards = 1 << num_shard_bits_;
+  size_t usage = 0;
+  for (int s = 0; s < num_shards; s++) {
+    usage += GetShard(s)->GetReservedUsage();
+  }
+  return usage;
+}
+
 void ShardedCache::ApplyToAllCacheEntries(void (*callback)(void*, size_t),
                                           bool thread_safe) {
   int num_shards = 1 << num_shard_bits_;
@@ -114,6 +384,24 @@ void ShardedCache::ApplyToAllCacheEntries(void (*callback)(void*, size_t),
   }
 }
 
+void ShardedCache::ApplyToAllEntries(const EntryCallback& callback,
+                                     size_t entries_per_lock, Env* env) {
+  int num_shards = 1 << num_shard_bits_;
+  std::shared_ptr<ApplyWalk> walk = std::make_shared<ApplyWalk>(
+      this, num_shards, &callback, entries_per_lock);
+  if (env != nullptr) {
+    for (int i = 1; i < num_shards; i++) {
+      env->Schedule(&ApplyWalk::RunHelper,
+                    new std::shared_ptr<ApplyWalk>(walk), Env::LOW);
+    }
+  }
+  walk->Run();
+  MutexLock l(&walk->mutex);
+  while (walk->done < num_shards) {
+    walk->cv.Wait();
+  }
+}
+
 void ShardedCache::EraseUnRefEntries() {
   int num_shards = 1 << num_shard_bits_;
   for (int s = 0; s < num_shards; s++) {
@@ -129,12 +417,12 @@ std::string ShardedCache::GetPrintableOptions() const {
   {
     MutexLock l(&capacity_mutex_);
     snprintf(buffer, kBufferSize, "    capacity : %" ROCKSDB_PRIszt "\n",
-             capacity_);
+             capacity_.load(std::memory_order_relaxed));
     ret.append(buffer);
     snprintf(buffer, kBufferSize, "    num_shard_bits : %d\n", num_shard_bits_);
     ret.append(buffer);
     snprintf(buffer, kBufferSize, "    strict_capacity_limit : %d\n",
-             strict_capacity_limit_);
+             strict_capacity_limit_.load(std::memory_order_relaxed));
     ret.append(buffer);
   }
   snprintf(buffer, kBufferSize, "    memory_allocator : %s\n",
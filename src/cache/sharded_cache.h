@@ -9,13 +9,21 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <memory>
 #include <string>
+#include <unordered_map>
 
+#include "namespace_generations.h"
 #include "port.h"
 #include "cache.h"
 #include "hash.h"
 
+// Kept out of this header, which applications include, along with the
+// thread pool it needs.
+class AsyncDeleter;
+
 // Single cache shard interface.
 class CacheShard {
  public:
@@ -26,7 +34,32 @@ class CacheShard {
                         size_t charge,
                         void (*deleter)(const Slice& key, void* value),
                         Cache::Handle** handle, Cache::Priority priority) = 0;
+  // Insert keys[indexes[i]] for i < n, all of which belong to this shard,
+  // with no handle.
+  virtual void MultiInsert(const Slice* keys, const uint32_t* hashes,
+                           void* const* values, const size_t* charges,
+                           const size_t* indexes, size_t n,
+                           void (*deleter)(const Slice& key, void* value),
+                           Cache::Priority priority) {
+    for (size_t i = 0; i < n; i++) {
+      size_t k = indexes[i];
+      Insert(keys[k], hashes[k], values[k], charges[k], deleter, nullptr,
+             priority);
+    }
+  }
   virtual Cache::Handle* Lookup(const Slice& key, uint32_t hash) = 0;
+  virtual bool Get(const Slice& key, uint32_t hash,
+                   const Cache::ReadCallback& reader) = 0;
+  // Look up keys[indexes[i]] for i < n, all of which belong to this shard,
+  // and store the results at handles[indexes[i]].
+  virtual void MultiLookup(const Slice* keys, const uint32_t* hashes,
+                           const size_t* indexes, size_t n,
+                           Cache::Handle** handles) {
+    for (size_t i = 0; i < n; i++) {
+      size_t k = indexes[i];
+      handles[k] = Lookup(keys[k], hashes[k]);
+    }
+  }
   virtual bool Ref(Cache::Handle* handle) = 0;
   virtual bool Release(Cache::Handle* handle, bool force_erase = false) = 0;
   virtual void Erase(const Slice& key, uint32_t hash) = 0;
@@ -34,8 +67,14 @@ class CacheShard {
   virtual void SetStrictCapacityLimit(bool strict_capacity_limit) = 0;
   virtual size_t GetUsage() const = 0;
   virtual size_t GetPinnedUsage() const = 0;
+  virtual size_t GetMetadataUsage() const { return 0; }
+  virtual bool Reserve(size_t charge) = 0;
+  virtual void Unreserve(size_t charge) = 0;
+  virtual size_t GetReservedUsage() const = 0;
   virtual void ApplyToAllCacheEntries(void (*callback)(void*, size_t),
                                       bool thread_safe) = 0;
+  virtual void ApplyToAllEntries(const Cache::EntryCallback& callback,
+                                 size_t entries_per_lock) = 0;
   virtual void EraseUnRefEntries() = 0;
   virtual std::string GetPrintableOptions() const { return ""; }
 	virtual void PrintCacheInfo() { printf("Not supported\n"); }
@@ -47,8 +86,9 @@ class CacheShard {
 class ShardedCache : public Cache {
  public:
   ShardedCache(size_t capacity, int num_shard_bits, bool strict_capacity_limit,
-               std::shared_ptr<MemoryAllocator> memory_allocator = nullptr);
-  virtual ~ShardedCache() = default;
+               std::shared_ptr<MemoryAllocator> memory_allocator = nullptr,
+               int async_deleter_threads = 0);
+  virtual ~ShardedCache();
   virtual const char* Name() const override = 0;
   virtual CacheShard* GetShard(int shard) = 0;
   virtual const CacheShard* GetShard(int shard) const = 0;
@@ -64,27 +104,88 @@ class ShardedCache : public Cache {
   virtual bool Insert(const Slice& key, void* value, size_t charge,
                         void (*deleter)(const Slice& key, void* value),
                         Handle** handle, Priority priority) override;
+  virtual void MultiInsert(const Slice* keys, void* const* values,
+                           const size_t* charges, size_t n,
+                           void (*deleter)(const Slice& key, void* value),
+                           Priority priority) override;
   virtual Handle* Lookup(const Slice& key) override;
+  virtual bool Insert(const HashedKey& key, void* value, size_t charge,
+                      void (*deleter)(const Slice& key, void* value),
+                      Handle** handle, Priority priority) override;
+  virtual Handle* Lookup(const HashedKey& key) override;
+  virtual void Erase(const HashedKey& key) override;
+  // Coalesces concurrent misses on a key: the first caller runs create,
+  // the others wait on its InFlightLoad and then look the key up again.
+  virtual Handle* GetOrCreate(const Slice& key, const CreateCallback& create,
+                              void (*deleter)(const Slice& key, void* value),
+                              Priority priority) override;
+  virtual void MultiLookup(const Slice* keys, size_t n,
+                           Handle** handles) override;
+  virtual bool Get(const Slice& key, const ReadCallback& reader) override;
   virtual bool Ref(Handle* handle) override;
   virtual bool Release(Handle* handle, bool force_erase = false) override;
   virtual void Erase(const Slice& key) override;
   virtual uint64_t NewId() override;
+  virtual bool EraseNamespace(uint64_t id) override;
   virtual size_t GetCapacity() const override;
   virtual bool HasStrictCapacityLimit() const override;
   virtual size_t GetUsage() const override;
   virtual size_t GetUsage(Handle* handle) const override;
   virtual size_t GetPinnedUsage() const override;
+  virtual size_t GetMetadataUsage() const override;
+  virtual void GetShardUsage(std::vector<size_t>* usage) const override;
+  virtual bool Reserve(uint32_t hash, size_t charge) override;
+  virtual void Unreserve(uint32_t hash, size_t charge) override;
+  virtual size_t GetReservedUsage() const override;
   virtual void ApplyToAllCacheEntries(void (*callback)(void*, size_t),
                                       bool thread_safe) override;
+  virtual void ApplyToAllEntries(const EntryCallback& callback,
+                                 size_t entries_per_lock = 256,
+                                 Env* env = nullptr) override;
   virtual void EraseUnRefEntries() override;
   virtual std::string GetPrintableOptions() const override;
   virtual void PrintCacheInfo() override;
 
   int GetNumShardBits() const { return num_shard_bits_; }
 
+ protected:
+  // nullptr unless the cache was created with async_deleter_threads > 0.
+  AsyncDeleter* async_deleter() const { return async_deleter_.get(); }
+
+  // Joins the async deleter's workers and runs every queued batch. Subclass
+  // destructors call this before destroying their shards, because queued
+  // batches still reference them.
+  void ShutdownAsyncDeleter();
+  // Passed to the shards, which check their entries against it.
+  const NamespaceGenerations* namespaces() const { return &namespaces_; }
+
  private:
+  // At most capacity / kAsyncDeleterQueueDivisor worth of charge may wait
+  // for the background deleter threads.
+  static const size_t kAsyncDeleterQueueDivisor = 8;
+
+  // MultiLookup() groups at most this many keys by shard at a time.
+  static const size_t kMultiLookupBatchSize = 64;
+
+  // A GetOrCreate() miss whose value is being created. Guarded by the mutex
+  // of the InFlightShard it belongs to.
+  struct InFlightLoad {
+    explicit InFlightLoad(port::Mutex* mu) : done(false), ok(false), cv(mu) {}
+
+    bool done;
+    // Whether the value was created and inserted.
+    bool ok;
+    port::CondVar cv;
+  };
+
+  // In-flight loads of the keys of one cache shard, keyed by the key bytes.
+  struct InFlightShard {
+    port::Mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<InFlightLoad>> loads;
+  };
+
   static inline uint32_t HashSlice(const Slice& s) {
-    return static_cast<uint32_t>(GetSliceNPHash64(s));
+    return HashedKey(s).hash;
   }
 
   uint32_t Shard(uint32_t hash) {
@@ -92,11 +193,36 @@ class ShardedCache : public Cache {
     return (num_shard_bits_ > 0) ? (hash >> (32 - num_shard_bits_)) : 0;
   }
 
+  // Sort indexes[0, n) by the shard of hashes[index], then call
+  // func(shard, group, group_size) once for each shard's run of indexes.
+  template <typename Func>
+  void ForEachShardGroup(const uint32_t* hashes, size_t* indexes, size_t n,
+                         Func func) {
+    std::sort(indexes, indexes + n, [&](size_t a, size_t b) {
+      return Shard(hashes[a]) < Shard(hashes[b]);
+    });
+    size_t begin = 0;
+    while (begin < n) {
+      uint32_t shard = Shard(hashes[indexes[begin]]);
+      size_t end = begin + 1;
+      while (end < n && Shard(hashes[indexes[end]]) == shard) {
+        end++;
+      }
+      func(shard, indexes + begin, end - begin);
+      begin = end;
+    }
+  }
+
   int num_shard_bits_;
   mutable port::Mutex capacity_mutex_;
-  size_t capacity_;
-  bool strict_capacity_limit_;
+  // Written under capacity_mutex_, read without it.
+  std::atomic<size_t> capacity_;
+  std::atomic<bool> strict_capacity_limit_;
   std::atomic<uint64_t> last_id_;
+  std::unique_ptr<AsyncDeleter> async_deleter_;
+  NamespaceGenerations namespaces_;
+  // One per cache shard.
+  std::unique_ptr<InFlightShard[]> in_flight_;
 };
 
 class MutexLock {
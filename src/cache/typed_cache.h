@@ -0,0 +1,397 @@
+//  Copyright (c) 2011-present, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "autovector.h"
+#include "hash.h"
+#include "port.h"
+#include "sharded_cache.h"
+
+// TypedCache<K, V, Policy> is a sharded LRU cache for a fixed key and value
+// type, for callers that do not need the type-erased Cache interface. It
+// follows LRUCacheShard's algorithm without the high-pri pool, but:
+//
+// - keys are stored in the entry and compared with Policy::Equal, which for
+//   integer keys is a single compare instead of Slice::compare's memcmp;
+// - keys are hashed by Policy::Hash, which is inline and, for integer
+//   keys, a multiply instead of MurmurHash over the key bytes;
+// - values are stored in the entry and destroyed by ~V() instead of a
+//   deleter called through a function pointer.
+//
+// Handles follow the Cache rules: every handle returned by Insert() or
+// Lookup() must be passed to Release().
+
+// Hashing and equality for TypedCache keys. The primary template hashes
+// the key's object representation, so K must be trivially copyable and
+// have no padding.
+template <class K, class Enable = void>
+struct TypedCachePolicy {
+  static uint32_t Hash(const K& key) {
+    static_assert(std::is_trivially_copyable<K>::value,
+                  "TypedCachePolicy hashes the key bytes; specialize it for "
+                  "keys that are not trivially copyable");
+#if __cplusplus >= 201703L
+    static_assert(std::has_unique_object_representations<K>::value,
+                  "TypedCachePolicy hashes the key bytes; specialize it for "
+                  "keys with padding or several representations of a value");
+#endif
+    return static_cast<uint32_t>(GetSliceNPHash64(
+        Slice(reinterpret_cast<const char*>(&key), sizeof(K))));
+  }
+  static bool Equal(const K& a, const K& b) { return a == b; }
+};
+
+// Integer keys: Fibonacci hashing. Consecutive keys spread over both the
+// high bits used for sharding and the low bits used for buckets.
+template <class K>
+struct TypedCachePolicy<
+    K, typename std::enable_if<std::is_integral<K>::value>::type> {
+  static constexpr uint32_t Hash(K key) {
+    return static_cast<uint32_t>(
+        (static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> 32);
+  }
+  static constexpr bool Equal(K a, K b) { return a == b; }
+};
+
+template <class K, class V, class Policy = TypedCachePolicy<K>>
+class TypedCache {
+ public:
+  // Opaque handle to an entry.
+  struct Handle {};
+
+  // num_shard_bits = -1 picks the same default as NewLRUCache.
+  explicit TypedCache(size_t capacity, int num_shard_bits = -1,
+                      bool strict_capacity_limit = false)
+      : num_shard_bits_(num_shard_bits >= 0
+                            ? num_shard_bits
+                            : GetDefaultCacheShardBits(capacity)),
+        num_shards_(1 << num_shard_bits_) {
+    shards_ = reinterpret_cast<Shard*>(
+        port::cacheline_aligned_alloc(sizeof(Shard) * num_shards_));
+    size_t per_shard = (capacity + (num_shards_ - 1)) / num_shards_;
+    for (int i = 0; i < num_shards_; i++) {
+      new (&shards_[i]) Shard(per_shard, strict_capacity_limit);
+    }
+  }
+
+  ~TypedCache() {
+    for (int i = 0; i < num_shards_; i++) {
+      shards_[i].~Shard();
+    }
+    port::cacheline_aligned_free(shards_);
+  }
+
+  // Insert key -> value with the given charge. If handle is not nullptr a
+  // handle to the new entry is returned through it. With
+  // strict_capacity_limit set, returns false and drops value if the entry
+  // does not fit and a handle was asked for; without a handle the entry is
+  // dropped as if evicted right away, like Cache::Insert.
+  bool Insert(const K& key, V value, size_t charge,
+              Handle** handle = nullptr) {
+    uint32_t hash = Policy::Hash(key);
+    Node* e = new Node(key, std::move(value), hash, charge);
+    Node* node = nullptr;
+    bool s = GetShard(hash).Insert(e, handle != nullptr ? &node : nullptr);
+    if (handle != nullptr) {
+      *handle = reinterpret_cast<Handle*>(node);
+    }
+    return s;
+  }
+
+  Handle* Lookup(const K& key) {
+    uint32_t hash = Policy::Hash(key);
+    return reinterpret_cast<Handle*>(GetShard(hash).Lookup(key, hash));
+  }
+
+  void Release(Handle* handle) {
+    Node* e = reinterpret_cast<Node*>(handle);
+    GetShard(e->hash).Release(e);
+  }
+
+  void Erase(const K& key) {
+    uint32_t hash = Policy::Hash(key);
+    GetShard(hash).Erase(key, hash);
+  }
+
+  V& Value(Handle* handle) { return reinterpret_cast<Node*>(handle)->value; }
+
+  void SetCapacity(size_t capacity) {
+    size_t per_shard = (capacity + (num_shards_ - 1)) / num_shards_;
+    for (int i = 0; i < num_shards_; i++) {
+      shards_[i].SetCapacity(per_shard);
+    }
+  }
+
+  size_t GetUsage() const {
+    size_t usage = 0;
+    for (int i = 0; i < num_shards_; i++) {
+      usage += shards_[i].GetUsage();
+    }
+    return usage;
+  }
+
+  // Like Cache::GetShardUsage().
+  void GetShardUsage(std::vector<size_t>* usage) const {
+    usage->resize(num_shards_);
+    for (int i = 0; i < num_shards_; i++) {
+      (*usage)[i] = shards_[i].GetUsage();
+    }
+  }
+
+ private:
+  struct Links {
+    Links* next;
+    Links* prev;
+  };
+
+  // An entry. On the LRU list exactly when it is in the table and has no
+  // references, as for LRUHandle.
+  struct Node : Links {
+    Node(const K& _key, V&& _value, uint32_t _hash, size_t _charge)
+        : key(_key),
+          value(std::move(_value)),
+          next_hash(nullptr),
+          charge(_charge),
+          hash(_hash),
+          refs(0),
+          in_cache(true) {}
+
+    K key;
+    V value;
+    Node* next_hash;
+    size_t charge;
+    uint32_t hash;
+    uint32_t refs;
+    bool in_cache;
+  };
+
+  typedef autovector<Node*> NodeList;
+
+  class ALIGN_AS(CACHE_LINE_SIZE) Shard {
+   public:
+    Shard(size_t capacity, bool strict_capacity_limit)
+        : capacity_(capacity),
+          strict_capacity_limit_(strict_capacity_limit),
+          usage_(0),
+          elems_(0),
+          buckets_(16, nullptr) {
+      lru_.next = &lru_;
+      lru_.prev = &lru_;
+    }
+
+    ~Shard() {
+      for (Node* h : buckets_) {
+        while (h != nullptr) {
+          Node* next = h->next_hash;
+          assert(h->refs == 0);
+          delete h;
+          h = next;
+        }
+      }
+    }
+
+    bool Insert(Node* e, Node** handle) {
+      bool s = true;
+      ScopedThreadLocal<NodeList> deleted;
+      {
+        MutexLock l(&mutex_);
+        EvictFromLRU(e->charge, deleted.get());
+        if (usage_ + e->charge > capacity_ &&
+            (strict_capacity_limit_ || handle == nullptr)) {
+          deleted->emplace_back(e);
+          if (handle != nullptr) {
+            *handle = nullptr;
+            s = false;
+          }
+        } else {
+          Node** ptr = FindPointer(e->key, e->hash);
+          Node* old = *ptr;
+          e->next_hash = old == nullptr ? nullptr : old->next_hash;
+          *ptr = e;
+          usage_ += e->charge;
+          if (old != nullptr) {
+            old->in_cache = false;
+            if (old->refs == 0) {
+              LRU_Remove(old);
+              usage_ -= old->charge;
+              deleted->emplace_back(old);
+            }
+          } else if (++elems_ > buckets_.size()) {
+            Resize();
+          }
+          if (handle == nullptr) {
+            LRU_Insert(e);
+          } else {
+            e->refs++;
+            *handle = e;
+          }
+        }
+      }
+      FreeNodes(*deleted);
+      return s;
+    }
+
+    Node* Lookup(const K& key, uint32_t hash) {
+      MutexLock l(&mutex_);
+      Node* e = *FindPointer(key, hash);
+      if (e != nullptr) {
+        if (e->refs == 0) {
+          LRU_Remove(e);
+        }
+        e->refs++;
+      }
+      return e;
+    }
+
+    void Release(Node* e) {
+      bool last_reference = false;
+      {
+        MutexLock l(&mutex_);
+        assert(e->refs > 0);
+        last_reference = --e->refs == 0;
+        if (last_reference && e->in_cache) {
+          if (usage_ > capacity_) {
+            RemoveFromTable(e);
+            e->in_cache = false;
+          } else {
+            LRU_Insert(e);
+            last_reference = false;
+          }
+        }
+        if (last_reference) {
+          usage_ -= e->charge;
+        }
+      }
+      if (last_reference) {
+        delete e;
+      }
+    }
+
+    void Erase(const K& key, uint32_t hash) {
+      Node* e = nullptr;
+      {
+        MutexLock l(&mutex_);
+        Node** ptr = FindPointer(key, hash);
+        e = *ptr;
+        if (e == nullptr) {
+          return;
+        }
+        *ptr = e->next_hash;
+        elems_--;
+        e->in_cache = false;
+        if (e->refs > 0) {
+          return;
+        }
+        LRU_Remove(e);
+        usage_ -= e->charge;
+      }
+      delete e;
+    }
+
+    void SetCapacity(size_t capacity) {
+      ScopedThreadLocal<NodeList> deleted;
+      {
+        MutexLock l(&mutex_);
+        capacity_ = capacity;
+        EvictFromLRU(0, deleted.get());
+      }
+      FreeNodes(*deleted);
+    }
+
+    size_t GetUsage() const {
+      MutexLock l(&mutex_);
+      return usage_;
+    }
+
+   private:
+    Node** FindPointer(const K& key, uint32_t hash) {
+      Node** ptr = &buckets_[hash & (buckets_.size() - 1)];
+      while (*ptr != nullptr &&
+             ((*ptr)->hash != hash || !Policy::Equal(key, (*ptr)->key))) {
+        ptr = &(*ptr)->next_hash;
+      }
+      return ptr;
+    }
+
+    void RemoveFromTable(Node* e) {
+      Node** ptr = FindPointer(e->key, e->hash);
+      assert(*ptr == e);
+      *ptr = e->next_hash;
+      elems_--;
+    }
+
+    void Resize() {
+      std::vector<Node*> buckets(buckets_.size() * 2, nullptr);
+      for (Node* h : buckets_) {
+        while (h != nullptr) {
+          Node* next = h->next_hash;
+          Node** ptr = &buckets[h->hash & (buckets.size() - 1)];
+          h->next_hash = *ptr;
+          *ptr = h;
+          h = next;
+        }
+      }
+      buckets_.swap(buckets);
+    }
+
+    void LRU_Remove(Node* e) {
+      e->next->prev = e->prev;
+      e->prev->next = e->next;
+    }
+
+    void LRU_Insert(Node* e) {
+      e->next = &lru_;
+      e->prev = lru_.prev;
+      e->prev->next = e;
+      e->next->prev = e;
+    }
+
+    void EvictFromLRU(size_t charge, NodeList* deleted) {
+      while (usage_ + charge > capacity_ && lru_.next != &lru_) {
+        Node* old = static_cast<Node*>(lru_.next);
+        LRU_Remove(old);
+        RemoveFromTable(old);
+        old->in_cache = false;
+        usage_ -= old->charge;
+        deleted->emplace_back(old);
+      }
+    }
+
+    static void FreeNodes(const NodeList& nodes) {
+      for (Node* e : nodes) {
+        delete e;
+      }
+    }
+
+    size_t capacity_;
+    bool strict_capacity_limit_;
+    size_t usage_;
+    size_t elems_;
+    std::vector<Node*> buckets_;
+    // lru_.prev is the newest entry, lru_.next the oldest.
+    Links lru_;
+    mutable port::Mutex mutex_;
+  };
+
+  Shard& GetShard(uint32_t hash) {
+    return shards_[num_shard_bits_ > 0 ? hash >> (32 - num_shard_bits_) : 0];
+  }
+
+  int num_shard_bits_;
+  int num_shards_;
+  Shard* shards_;
+
+  // No copying allowed
+  TypedCache(const TypedCache&);
+  void operator=(const TypedCache&);
+};
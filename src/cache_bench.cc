@@ -1,12 +1,33 @@
 #include <cinttypes>
+#include <math.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "alloc_counter.h"
+#include "async_lookup.h"
+#include "cache_trace.h"
+#include "cycle_clock.h"
+#include "histogram.h"
 #include "port.h"
 #include "slice.h"
 #include "cache.h"
 #include "env.h"
+#include "key_generator.h"
+#include "perf_counters.h"
 #include "random.h"
+#include "typed_cache.h"
+#include "value_size_generator.h"
 #include "gflags/gflags.h"
 
 using GFLAGS_NAMESPACE::ParseCommandLineFlags;
@@ -19,38 +40,262 @@ DEFINE_int64(cache_size, 8 * KB * KB,
 DEFINE_int32(num_shard_bits, 4, "shard_bits.");
 
 DEFINE_int64(max_key, 1 * KB * KB * KB, "Max number of key to place in cache");
+DEFINE_string(key_dist, "uniform",
+              "Key distribution: uniform, zipf, scrambled_zipf, hotspot or "
+              "latest.");
+DEFINE_double(zipf_theta, 0.99,
+              "Skew of the zipf, scrambled_zipf and latest distributions, in "
+              "(0, 1).");
+DEFINE_double(hotspot_set_fraction, 0.2,
+              "Fraction of the key space that is hot with -key_dist=hotspot.");
+DEFINE_double(hotspot_op_fraction, 0.8,
+              "Fraction of the ops that hit the hot keys with "
+              "-key_dist=hotspot.");
 DEFINE_uint64(ops_per_thread, 1200000, "Number of operations per thread.");
+DEFINE_int32(duration_sec, 0,
+             "If > 0, run each test for this many seconds instead of "
+             "-ops_per_thread ops.");
 
 DEFINE_bool(populate_cache, false, "Populate cache before operations");
+DEFINE_int32(populate_batch, 256,
+             "Entries per MultiInsert call when populating the cache; "
+             "1 inserts them one at a time.");
 DEFINE_int32(insert_percent, 40,
              "Ratio of insert to total workload (expressed as a percentage)");
 DEFINE_int32(lookup_percent, 50,
              "Ratio of lookup to total workload (expressed as a percentage)");
 DEFINE_int32(erase_percent, 10,
              "Ratio of erase to total workload (expressed as a percentage)");
+DEFINE_bool(histogram, false,
+            "Time every op and report latency percentiles per op type. Off "
+            "by default, since the two clock reads per op cost throughput.");
+DEFINE_bool(perf_counters, false,
+            "Report cycles, instructions, LLC, dTLB and branch misses and "
+            "context switches per op, counted with perf_event_open. Counts "
+            "cover each thread's whole op loop, including key generation and "
+            "-histogram timing, but not -target_qps_per_thread's waits. "
+            "Counters the kernel or container does not allow are reported "
+            "as n/a.");
+DEFINE_double(target_qps_per_thread, 0,
+              "If > 0, run open-loop: each thread starts ops at this rate "
+              "whether or not the previous ones have finished. With -histogram, "
+              "latency is also reported from each op's intended start.");
+DEFINE_string(arrival_dist, "poisson",
+              "Inter-arrival times with -target_qps_per_thread: poisson "
+              "(exponential gaps) or constant.");
 DEFINE_int32(test_count, 1,
 			   "Times of test for the current cache operation");
 
 DEFINE_bool(use_clock_cache, false, "");
+DEFINE_bool(use_typed_cache, false,
+            "Run against TypedCache<uint64_t, BenchValue> instead of a Cache, "
+            "to measure the cost of type-erased Slice keys and deleters.");
+DEFINE_int32(multi_lookup_batch, 1,
+             "If > 1, each lookup op looks up this many keys via MultiLookup.");
+DEFINE_bool(use_get_copy, false,
+            "Read values with GetCopy() instead of Lookup() and Release().");
+DEFINE_int32(loader_latency_us, 0,
+             "If > 0, lookup misses call a simulated loader with this mean "
+             "latency and insert its value.");
+DEFINE_string(loader_latency_dist, "fixed",
+              "Loader latency distribution: fixed, uniform (0 to twice the "
+              "mean) or exponential.");
+DEFINE_int32(async_lookup_batch, 0,
+             "With -loader_latency_us, issue each lookup op as this many "
+             "LookupAsync calls and wait for them together. 0 loads misses "
+             "inline through GetOrCreate.");
+DEFINE_int32(loader_threads, 16,
+             "Thread pool threads running LookupAsync loaders.");
+DEFINE_int32(async_deleter_threads, 0,
+             "If > 0, run entry deleters on this many background threads.");
+DEFINE_bool(metadata_charged, false,
+            "Charge handle, key and hash table memory against the capacity.");
+DEFINE_bool(use_huge_page_arena, false,
+            "Back LRU cache entries with 2MB huge pages instead of 4KB pages.");
+DEFINE_bool(strict_capacity_limit, false,
+            "Fail inserts that do not fit instead of going over capacity. "
+            "Inserts then take a handle, since only those report failure, "
+            "and the rejection rate is printed.");
+DEFINE_int32(value_size, 0,
+             "Mean size in bytes of the values inserted, which are charged "
+             "their size. 0 inserts 10-byte values charged 1, so that "
+             "-cache_size counts entries.");
+DEFINE_string(value_size_dist, "fixed",
+              "Distribution of -value_size: fixed, uniform, lognormal or "
+              "bimodal.");
+DEFINE_double(value_size_sigma, 1.0,
+              "Sigma of the underlying normal for -value_size_dist=lognormal.");
+DEFINE_double(bimodal_large_fraction, 0.1,
+              "Fraction of large values for -value_size_dist=bimodal.");
+DEFINE_double(bimodal_large_ratio, 16,
+              "Size of the large values over the small ones for "
+              "-value_size_dist=bimodal.");
+DEFINE_int32(usage_sample_ms, 0,
+             "If > 0, sample usage and pinned usage this often during each "
+             "test and print them, with the throughput, hit rate and shard "
+             "usage skew (largest over mean) since the previous sample. The "
+             "samples are also in the json results.");
+DEFINE_string(trace_file, "",
+              "Replay this cache trace instead of generating ops. Traced "
+              "thread i is replayed by thread i % threads, which interleaves "
+              "its traced threads by timestamp. Inserts keep their traced "
+              "charge, so size -cache_size like the traced cache.");
+DEFINE_string(record_trace, "",
+              "Trace the ops of the run to this file, for -trace_file.");
+DEFINE_string(sweep_threads, "",
+              "Run once for each of these thread counts instead of -threads: "
+              "a comma-separated list such as 1,2,4,8, or a range such as "
+              "1..8.");
+DEFINE_string(sweep_shard_bits, "",
+              "Run once for each of these shard bits instead of "
+              "-num_shard_bits, combined with every -sweep_threads count; "
+              "same syntax. The cache is rebuilt, and repopulated with "
+              "-populate_cache, for every run after the first.");
+DEFINE_string(cache_types, "",
+              "Compare these caches, a comma-separated list of lru and "
+              "clock, on identical ops: each thread's ops are drawn once, "
+              "untimed, and replayed against each cache in turn (or the "
+              "-trace_file is), then one table sums up the runs. Keeps about "
+              "42 bytes per op in memory; see -workload_mb.");
+DEFINE_int32(workload_mb, 1024,
+             "With -cache_types and no -trace_file, the most memory the ops "
+             "drawn up front may take. Larger runs are rejected: lower "
+             "-threads or -ops_per_thread, or raise this.");
+DEFINE_string(output_format, "text",
+              "Results as text, json (one object per run) or csv (one row "
+              "per run).");
+DEFINE_string(output_file, "",
+              "Write the json or csv results here instead of stdout. When "
+              "they go to stdout, the text report goes to stderr.");
+
 
 namespace rocksdb {
 
 class CacheBench;
 namespace {
+// Values deleted by the current thread: entries its ops evicted, replaced or
+// erased, unless -async_deleter_threads moves the deleters elsewhere.
+thread_local uint64_t tls_num_deleted = 0;
+
 void deleter(const Slice& /*key*/, void* value) {
-    delete reinterpret_cast<char *>(value);
+    ++tls_num_deleted;
+    delete[] reinterpret_cast<char *>(value);
+}
+
+// Draws the value sizes with -value_size; shared by all threads.
+const ValueSizeGenerator* value_sizes = nullptr;
+
+// A new value to insert and its charge: -value_size bytes, written so that
+// its pages are really in use, or a 10-byte buffer charged 1.
+char* NewValue(Random* rnd, size_t* charge) {
+  if (value_sizes == nullptr) {
+    *charge = 1;
+    return new char[10];
+  }
+  size_t size = value_sizes->Next(rnd);
+  char* value = new char[size];
+  memset(value, 'v', size);
+  *charge = size;
+  return value;
+}
+
+// A value for a replayed insert of the given charge: charge bytes with
+// -value_size, like the value NewValue() drew that charge for.
+char* ReplayedValue(size_t charge) {
+  if (value_sizes == nullptr) {
+    return new char[10];
+  }
+  char* value = new char[charge];
+  memset(value, 'v', charge);
+  return value;
+}
+
+// The byte length of a value from NewValue() or ReplayedValue() charged
+// charge, for GetCopy().
+size_t ValueLength(const void* /*value*/, size_t charge) {
+  return value_sizes == nullptr ? 10 : charge;
 }
 
+// The encoded size of a -cache_types workload record, whose key is 8 bytes,
+// and the memory it takes with the pointer the replaying thread follows.
+const size_t kWorkloadRecordSize = CacheTraceRecord::kHeaderSize + 8;
+const size_t kWorkloadBytesPerOp =
+    kWorkloadRecordSize + sizeof(const char*);
+
+// Loads done by SimulatedLoad().
+std::atomic<uint64_t> num_loads(0);
+
+// Loader for lookup misses with -loader_latency_us. Sleeps for a latency
+// drawn from -loader_latency_dist, then returns a value like the ones the
+// bench inserts directly.
+void* SimulatedLoad(const Slice& /*key*/, size_t* charge) {
+  static thread_local std::mt19937_64 rng(
+      std::hash<std::thread::id>()(std::this_thread::get_id()));
+  double mean = FLAGS_loader_latency_us;
+  double latency = mean;
+  if (FLAGS_loader_latency_dist == "uniform") {
+    latency = std::uniform_real_distribution<double>(0, 2 * mean)(rng);
+  } else if (FLAGS_loader_latency_dist == "exponential") {
+    latency = std::exponential_distribution<double>(1 / mean)(rng);
+  }
+  std::this_thread::sleep_for(
+      std::chrono::microseconds(static_cast<int64_t>(latency)));
+  num_loads.fetch_add(1, std::memory_order_relaxed);
+  static thread_local Random rnd(static_cast<uint32_t>(rng()));
+  return NewValue(&rnd, charge);
+}
+
+// Op types timed by -histogram. MultiLookup and loading lookups are timed
+// per call, not per key.
+enum OpType {
+  kOpInsert,
+  kOpLookupHit,
+  kOpLookupMiss,
+  kOpErase,
+  kOpRelease,
+  kOpMultiLookup,
+  kOpLoadingLookup,
+  // With -target_qps_per_thread: a whole op, from its intended start.
+  kOpScheduled,
+  kNumOpTypes,
+};
+
+const char* const kOpTypeNames[kNumOpTypes] = {
+    "insert", "lookup hit", "lookup miss", "erase",
+    "release", "multi lookup", "loading lookup", "scheduled op",
+};
+
+// The TypedCache counterpart of the buffers inserted into Cache: the same
+// NewValue() allocation, freed and counted by deleter() when ~BenchValue()
+// runs, so the two paths differ only in how keys and values are passed.
+struct BenchValueDeleter {
+  void operator()(char* value) const { deleter(Slice(), value); }
+};
+typedef std::unique_ptr<char[], BenchValueDeleter> BenchValue;
+typedef TypedCache<uint64_t, BenchValue> BenchTypedCache;
+
 // State shared by all concurrent executions of the same benchmark.
 class SharedState {
  public:
-  explicit SharedState(CacheBench* cache_bench)
+  SharedState(CacheBench* cache_bench, uint32_t num_threads)
       : cv_(&mu_),
-        num_threads_(FLAGS_threads),
+        num_threads_(num_threads),
         num_initialized_(0),
         start_(false),
+        stop_(false),
         num_done_(0),
+        num_ops_(0),
+        num_allocs_(0),
+        num_lookups_(0),
+        num_hits_(0),
+        num_inserts_(0),
+        num_rejected_(0),
+        num_deleted_(0),
         cache_bench_(cache_bench) {
+    for (int i = 0; i < PerfCounters::kNumCounters; i++) {
+      perf_values_[i] = 0;
+      perf_threads_[i] = 0;
+    }
   }
 
   ~SharedState() {}
@@ -91,6 +336,92 @@ class SharedState {
     return start_;
   }
 
+  // With -duration_sec: tells the threads to finish their current op and
+  // stop.
+  void SetStop() {
+    stop_.store(true, std::memory_order_relaxed);
+  }
+
+  bool Stopped() const {
+    return stop_.load(std::memory_order_relaxed);
+  }
+
+  void AddOps(uint64_t ops) {
+    num_ops_.fetch_add(ops, std::memory_order_relaxed);
+  }
+
+  uint64_t GetOps() const {
+    return num_ops_.load(std::memory_order_relaxed);
+  }
+
+  void AddAllocs(uint64_t num_allocs) {
+    num_allocs_.fetch_add(num_allocs, std::memory_order_relaxed);
+  }
+
+  uint64_t GetAllocs() const {
+    return num_allocs_.load(std::memory_order_relaxed);
+  }
+
+  // REQUIRES: mu_ held.
+  void MergeLatencies(const std::vector<LatencyHistogram>& latencies) {
+    latencies_.resize(latencies.size());
+    for (size_t i = 0; i < latencies.size(); i++) {
+      latencies_[i].Merge(latencies[i]);
+    }
+  }
+
+  const std::vector<LatencyHistogram>& GetLatencies() const {
+    return latencies_;
+  }
+
+  // REQUIRES: mu_ held.
+  void MergePerfCounters(const PerfCounters& perf) {
+    for (int i = 0; i < PerfCounters::kNumCounters; i++) {
+      if (perf.Available(i)) {
+        perf_values_[i] += perf.Value(i);
+        perf_threads_[i]++;
+      }
+    }
+  }
+
+  // Whether every thread could count counter i.
+  bool PerfCounterAvailable(int i) const {
+    return perf_threads_[i] == num_threads_;
+  }
+
+  uint64_t GetPerfCounter(int i) const { return perf_values_[i]; }
+
+  void AddLookups(uint64_t lookups, uint64_t hits) {
+    num_lookups_.fetch_add(lookups, std::memory_order_relaxed);
+    num_hits_.fetch_add(hits, std::memory_order_relaxed);
+  }
+
+  uint64_t GetLookups() const {
+    return num_lookups_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t GetHits() const {
+    return num_hits_.load(std::memory_order_relaxed);
+  }
+
+  void AddInserts(uint64_t inserts, uint64_t rejected, uint64_t deleted) {
+    num_inserts_.fetch_add(inserts, std::memory_order_relaxed);
+    num_rejected_.fetch_add(rejected, std::memory_order_relaxed);
+    num_deleted_.fetch_add(deleted, std::memory_order_relaxed);
+  }
+
+  uint64_t GetInserts() const {
+    return num_inserts_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t GetRejected() const {
+    return num_rejected_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t GetDeleted() const {
+    return num_deleted_.load(std::memory_order_relaxed);
+  }
+
  private:
   port::Mutex mu_;
   port::CondVar cv_;
@@ -98,33 +429,292 @@ class SharedState {
   const uint64_t num_threads_;
   uint64_t num_initialized_;
   bool start_;
+  std::atomic<bool> stop_;
   uint64_t num_done_;
+  std::atomic<uint64_t> num_ops_;
+  std::atomic<uint64_t> num_allocs_;
+  std::atomic<uint64_t> num_lookups_;
+  std::atomic<uint64_t> num_hits_;
+  std::atomic<uint64_t> num_inserts_;
+  std::atomic<uint64_t> num_rejected_;
+  std::atomic<uint64_t> num_deleted_;
+  // Per OpType, merged from the threads as they finish.
+  std::vector<LatencyHistogram> latencies_;
+  // Per PerfCounters::Counter: the sum over the threads that could count
+  // it, and how many those were.
+  uint64_t perf_values_[PerfCounters::kNumCounters];
+  uint64_t perf_threads_[PerfCounters::kNumCounters];
 
   CacheBench* cache_bench_;
 };
 
+// A count that one bench thread bumps and the -usage_sample_ms sampler
+// reads while it runs. A relaxed load and store rather than a locked add,
+// since only the owner writes it.
+class ThreadCounter {
+ public:
+  ThreadCounter() : value_(0) {}
+
+  void operator++(int) { *this += 1; }
+
+  void operator+=(uint64_t n) {
+    value_.store(value_.load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
+  }
+
+  operator uint64_t() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_;
+};
+
 // Per-thread state for concurrent executions of the same benchmark.
 struct ThreadState {
   uint32_t tid;
   Random rnd;
   SharedState* shared;
+  // Ops run so far.
+  ThreadCounter ops;
+  // Keys looked up, and how many of them were found. Under
+  // -loader_latency_us only lookups are counted; misses are the loads.
+  ThreadCounter lookups;
+  ThreadCounter hits;
+  // Inserts, and how many of them -strict_capacity_limit rejected.
+  uint64_t inserts;
+  uint64_t rejected;
+  // Per OpType, in clock ticks. Empty without -histogram.
+  std::vector<LatencyHistogram> latencies;
+  // Opened with -perf_counters.
+  PerfCounters perf;
+  // With -target_qps_per_thread: the intended start of the next op and of
+  // the current one, in clock ticks. 0 until the first op.
+  uint64_t next_arrival;
+  uint64_t intended_start;
+  // Reused by every MultiLookup op of the thread.
+  std::vector<uint64_t> multi_key_data;
+  std::vector<Slice> multi_keys;
+  std::vector<Cache::Handle*> multi_handles;
+  // -use_get_copy copies into this; grown to the largest value found.
+  std::vector<char> copy_buf;
+  // Reused by every LookupAsync batch of the thread.
+  std::vector<std::future<Cache::Handle*>> pending_lookups;
 
   ThreadState(uint32_t index, SharedState* _shared)
-      : tid(index), rnd(1000 + index), shared(_shared) {}
+      : tid(index),
+        // Spread out: with small consecutive seeds, some threads landed on
+        // the sequence PopulateCache() draws from seed 1 and replayed it.
+        rnd((index + 1) * 0x9E3779B9u),
+        shared(_shared),
+        inserts(0),
+        rejected(0),
+        latencies(FLAGS_histogram ? kNumOpTypes : 0),
+        next_arrival(0),
+        intended_start(0),
+        copy_buf(16) {}
+};
+
+// A -usage_sample_ms sample, taken the given seconds into a test. The
+// throughput and hit rate are those since the previous sample.
+struct UsageSample {
+  double seconds;
+  size_t usage;
+  size_t pinned_usage;
+  double ops_per_sec;
+  // -1 if there were no lookups.
+  double hit_rate;
+  // The largest shard usage over the mean one: 1 when they are even.
+  double shard_skew;
 };
+
+// The outcome of one test, for -output_format.
+struct BenchResult {
+  std::string cache;
+  uint32_t threads;
+  int shard_bits;
+  int test;
+  double seconds;
+  uint64_t ops;
+  double cpu_seconds;
+  double allocs_per_op;
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t inserts;
+  uint64_t rejected;
+  // Values dropped per insert, or -1 if the deleters ran elsewhere.
+  double dropped_per_insert;
+  // The largest pinned usage sampled, or the one at the end without
+  // -usage_sample_ms.
+  size_t max_pinned_usage;
+  // Per OpType, in clock ticks.
+  std::vector<LatencyHistogram> latencies;
+  // With -perf_counters: per PerfCounters::Counter, the count per op, or -1
+  // if it was not available.
+  std::vector<double> perf_per_op;
+  // With -usage_sample_ms.
+  std::vector<UsageSample> usage_samples;
+};
+
+// Splits "a,b,c" into *names.
+void ParseNameList(const std::string& list, std::vector<std::string>* names) {
+  names->clear();
+  size_t begin = 0;
+  while (true) {
+    size_t end = list.find(',', begin);
+    names->push_back(list.substr(begin, end - begin));
+    if (end == std::string::npos) {
+      return;
+    }
+    begin = end + 1;
+  }
+}
+
+// Parses "a,b,c" or "a..b" into *values. Returns false on anything else.
+bool ParseIntList(const std::string& list, std::vector<int>* values) {
+  values->clear();
+  size_t range = list.find("..");
+  if (range != std::string::npos) {
+    char* end;
+    long lo = strtol(list.c_str(), &end, 10);
+    if (end != list.c_str() + range) {
+      return false;
+    }
+    const char* hi_str = list.c_str() + range + 2;
+    long hi = strtol(hi_str, &end, 10);
+    if (end == hi_str || *end != '\0' || hi < lo) {
+      return false;
+    }
+    for (long v = lo; v <= hi; v++) {
+      values->push_back(static_cast<int>(v));
+    }
+    return true;
+  }
+  const char* p = list.c_str();
+  while (true) {
+    char* end;
+    long v = strtol(p, &end, 10);
+    if (end == p) {
+      return false;
+    }
+    values->push_back(static_cast<int>(v));
+    if (*end == '\0') {
+      return true;
+    }
+    if (*end != ',') {
+      return false;
+    }
+    p = end + 1;
+  }
+}
 }  // namespace
 
 class CacheBench {
  public:
-  CacheBench() : num_threads_(FLAGS_threads) {
-    if (FLAGS_use_clock_cache) {
-      cache_ = NewClockCache(FLAGS_cache_size, FLAGS_num_shard_bits);
+  CacheBench()
+      : num_threads_(FLAGS_threads),
+        num_shard_bits_(FLAGS_num_shard_bits),
+        out_(stdout),
+        results_out_(nullptr) {
+    if (!FLAGS_sweep_threads.empty()) {
+      ParseIntList(FLAGS_sweep_threads, &sweep_threads_);
+    } else {
+      sweep_threads_.push_back(FLAGS_threads);
+    }
+    if (!FLAGS_sweep_shard_bits.empty()) {
+      ParseIntList(FLAGS_sweep_shard_bits, &sweep_shard_bits_);
+    } else {
+      sweep_shard_bits_.push_back(FLAGS_num_shard_bits);
+    }
+    num_threads_ = sweep_threads_[0];
+    num_shard_bits_ = sweep_shard_bits_[0];
+    if (!FLAGS_cache_types.empty()) {
+      ParseNameList(FLAGS_cache_types, &cache_types_);
+    } else if (FLAGS_use_typed_cache) {
+      cache_types_.push_back("typed");
+    } else {
+      cache_types_.push_back(FLAGS_use_clock_cache ? "clock" : "lru");
+    }
+    cache_type_ = cache_types_[0];
+    if (FLAGS_output_format != "text") {
+      if (FLAGS_output_file.empty()) {
+        results_out_ = stdout;
+        out_ = stderr;
+      } else {
+        results_out_ = fopen(FLAGS_output_file.c_str(), "w");
+        if (results_out_ == nullptr) {
+          fprintf(stderr, "cannot create %s\n", FLAGS_output_file.c_str());
+          exit(1);
+        }
+      }
+    }
+
+    KeyGenerator::Distribution dist = KeyGenerator::kUniform;
+    KeyGenerator::ParseDistribution(FLAGS_key_dist, &dist);
+    keys_.reset(new KeyGenerator(dist, FLAGS_max_key, FLAGS_zipf_theta,
+                                 FLAGS_hotspot_set_fraction,
+                                 FLAGS_hotspot_op_fraction));
+    unpopulated_keys_ = keys_->SaveState();
+    if (FLAGS_value_size > 0) {
+      ValueSizeGenerator::Distribution value_dist = ValueSizeGenerator::kFixed;
+      ValueSizeGenerator::ParseDistribution(FLAGS_value_size_dist,
+                                            &value_dist);
+      value_sizes_.reset(new ValueSizeGenerator(
+          value_dist, FLAGS_value_size, FLAGS_value_size_sigma,
+          FLAGS_bimodal_large_fraction, FLAGS_bimodal_large_ratio));
+      value_sizes = value_sizes_.get();
+    }
+    if (FLAGS_histogram || FLAGS_target_qps_per_thread > 0) {
+      // Calibrate before any thread times or paces an op.
+      CycleClock::NanosPerTick();
+    }
+    if (FLAGS_perf_counters) {
+      // Only to tell in PrintEnv() which counters are missing and why; each
+      // thread opens its own.
+      PerfCounters probe;
+      probe.Open(&perf_error_);
+    }
+    NewCache();
+    if (!FLAGS_record_trace.empty()) {
+      tracer_ = NewTracingCache(cache_, FLAGS_record_trace);
+      if (!tracer_) {
+        fprintf(stderr, "cannot create trace file %s\n",
+                FLAGS_record_trace.c_str());
+        exit(1);
+      }
+      cache_ = tracer_;
+    }
+    if (!FLAGS_trace_file.empty()) {
+      LoadTrace();
+    }
+    if (FLAGS_loader_latency_us > 0 && FLAGS_async_lookup_batch > 0) {
+      Env::Default()->SetBackgroundThreads(FLAGS_loader_threads, Env::LOW);
+    }
+  }
+
+  // (Re)creates the cache under test: a cache_type_ with num_shard_bits_.
+  void NewCache() {
+    cache_.reset();
+    typed_cache_.reset();
+    if (cache_type_ == "typed") {
+      typed_cache_.reset(new BenchTypedCache(
+          FLAGS_cache_size, num_shard_bits_, FLAGS_strict_capacity_limit));
+    } else if (cache_type_ == "clock") {
+      ClockCacheOptions opts(FLAGS_cache_size, num_shard_bits_,
+                             FLAGS_strict_capacity_limit);
+      opts.async_deleter_threads = FLAGS_async_deleter_threads;
+      opts.metadata_charged = FLAGS_metadata_charged;
+      cache_ = NewClockCache(opts);
       if (!cache_) {
         fprintf(stderr, "Clock cache not supported.\n");
         exit(1);
       }
     } else {
-      cache_ = NewLRUCache(FLAGS_cache_size, FLAGS_num_shard_bits);
+      LRUCacheOptions opts(FLAGS_cache_size, num_shard_bits_,
+                           FLAGS_strict_capacity_limit,
+                           0.5 /* high_pri_pool_ratio */);
+      opts.async_deleter_threads = FLAGS_async_deleter_threads;
+      opts.metadata_charged = FLAGS_metadata_charged;
+      opts.use_huge_page_arena = FLAGS_use_huge_page_arena;
+      cache_ = NewLRUCache(opts);
     }
   }
 
@@ -142,27 +732,197 @@ class CacheBench {
 		void operator=(const MutexLock&);
 	};
 
-  ~CacheBench() {}
+  ~CacheBench() {
+    if (results_out_ != nullptr && results_out_ != stdout) {
+      fclose(results_out_);
+    }
+  }
+
+  // Maps -trace_file.
+  void LoadTrace() {
+    trace_.reset(new CacheTraceReader());
+    std::string error;
+    if (!trace_->Open(FLAGS_trace_file, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      exit(1);
+    }
+  }
+
+  // Splits the trace records among num_threads_ bench threads, each
+  // thread's share sorted by timestamp. Traced threads keep their order,
+  // since their own records are already sorted.
+  void SplitTrace() {
+    replay_.clear();
+    replay_.resize(num_threads_);
+    for (size_t i = 0; i < trace_->NumThreads(); i++) {
+      const std::vector<const char*>& records = trace_->ThreadRecords(i);
+      std::vector<const char*>& replay = replay_[i % num_threads_];
+      replay.insert(replay.end(), records.begin(), records.end());
+    }
+    for (auto& replay : replay_) {
+      std::stable_sort(replay.begin(), replay.end(),
+                       [](const char* a, const char* b) {
+                         return CacheTraceRecord::Decode(a).timestamp <
+                                CacheTraceRecord::Decode(b).timestamp;
+                       });
+    }
+  }
+
+  // For -cache_types without -trace_file: draws the ops num_threads_
+  // threads run, as OperateCache() would draw them, and encodes them as
+  // trace records for ReplayTrace(). Every cache then replays the same ops,
+  // and drawing them is not timed.
+  void GenerateWorkload() {
+    workload_.assign(num_threads_, std::string());
+    replay_.assign(num_threads_, std::vector<const char*>());
+    for (uint32_t t = 0; t < num_threads_; t++) {
+      // Seeded like ThreadState::rnd.
+      Random rnd((t + 1) * 0x9E3779B9u);
+      std::string& records = workload_[t];
+      // Sized up front, so records never reallocates under replay_[t] and
+      // never holds twice its size while growing.
+      records.reserve(FLAGS_ops_per_thread * kWorkloadRecordSize);
+      replay_[t].reserve(FLAGS_ops_per_thread);
+      for (uint64_t i = 0; i < FLAGS_ops_per_thread; i++) {
+        uint64_t rand_key = keys_->Next(&rnd);
+        int32_t prob_op = static_cast<int32_t>(rnd.Uniform(100));
+        CacheTraceRecord record;
+        record.timestamp = i;
+        record.charge = 0;
+        record.priority = Cache::Priority::LOW;
+        if (prob_op < FLAGS_insert_percent) {
+          rand_key = keys_->InsertKey(rand_key);
+          record.op = kTraceInsert;
+          record.charge = value_sizes != nullptr ? value_sizes->Next(&rnd) : 1;
+        } else if (prob_op < FLAGS_insert_percent + FLAGS_lookup_percent) {
+          record.op = kTraceLookup;
+        } else if (prob_op < FLAGS_insert_percent + FLAGS_lookup_percent +
+                                 FLAGS_erase_percent) {
+          record.op = kTraceErase;
+        } else {
+          continue;
+        }
+        record.key = Slice(reinterpret_cast<char*>(&rand_key), 8);
+        record.hash = HashedKey(record.key).hash;
+        replay_[t].push_back(records.data() + records.size());
+        record.EncodeTo(&records);
+      }
+    }
+  }
 
   void PopulateCache() {
+    Env* env = Env::Default();
+    uint64_t start_time = env->NowMicros();
     Random rnd(1);
-    for (int64_t i = 0; i < FLAGS_cache_size; i++) {
-      uint64_t rand_key = rnd.Next() % FLAGS_max_key;
-      // Cast uint64* to be char*, data would be copied to cache
-      Slice key(reinterpret_cast<char*>(&rand_key), 8);
-      // do insert
-      cache_->Insert(key, new char[10], 1, &deleter);
+    if (typed_cache_) {
+      for (int64_t i = 0; i < FLAGS_cache_size; i++) {
+        size_t charge;
+        uint64_t key = keys_->InsertKey(keys_->Next(&rnd));
+        BenchValue value(NewValue(&rnd, &charge));
+        typed_cache_->Insert(key, std::move(value), charge);
+      }
+    } else if (FLAGS_populate_batch <= 1) {
+      // Until the charges add up to the capacity: -cache_size entries
+      // without -value_size.
+      size_t charge;
+      for (int64_t filled = 0; filled < FLAGS_cache_size; filled += charge) {
+        uint64_t rand_key = keys_->InsertKey(keys_->Next(&rnd));
+        // Cast uint64* to be char*, data would be copied to cache
+        Slice key(reinterpret_cast<char*>(&rand_key), 8);
+        // do insert
+        char* value = NewValue(&rnd, &charge);
+        cache_->Insert(key, value, charge, &deleter);
+      }
+    } else {
+      size_t batch = static_cast<size_t>(FLAGS_populate_batch);
+      std::vector<uint64_t> key_data(batch);
+      std::vector<Slice> keys(batch);
+      std::vector<void*> values(batch);
+      std::vector<size_t> charges(batch);
+      int64_t filled = 0;
+      while (filled < FLAGS_cache_size) {
+        size_t n = 0;
+        while (n < batch && filled < FLAGS_cache_size) {
+          key_data[n] = keys_->InsertKey(keys_->Next(&rnd));
+          keys[n] = Slice(reinterpret_cast<char*>(&key_data[n]), 8);
+          values[n] = NewValue(&rnd, &charges[n]);
+          filled += charges[n];
+          n++;
+        }
+        cache_->MultiInsert(keys.data(), values.data(), charges.data(), n,
+                            &deleter);
+      }
     }
+    uint64_t end_time = env->NowMicros();
+    fprintf(out_, "Populate: %.3f s\n",
+            static_cast<double>(end_time - start_time) * 1e-6);
   }
 
   bool Run() {
-    Env* env = Env::Default();
-
     PrintEnv();
 
+    bool sweep = sweep_threads_.size() > 1 || sweep_shard_bits_.size() > 1;
+    bool compare = !FLAGS_cache_types.empty();
+    bool first = true;
+    // Under -key_dist=latest, inserts advance keys_. Every cache is populated
+    // from the state the first one was, and every workload is drawn from the
+    // state populating left, so that each cache sees the same keys.
+    uint64_t populated_keys = keys_->SaveState();
+    for (int shard_bits : sweep_shard_bits_) {
+      for (int threads : sweep_threads_) {
+        num_threads_ = threads;
+        if (trace_) {
+          SplitTrace();
+        } else if (compare) {
+          keys_->RestoreState(populated_keys);
+          GenerateWorkload();
+        }
+        for (const std::string& cache_type : cache_types_) {
+          if (!first) {
+            // The first run reuses the cache the constructor built and
+            // main() populated.
+            num_shard_bits_ = shard_bits;
+            cache_type_ = cache_type;
+            NewCache();
+            if (FLAGS_populate_cache) {
+              keys_->RestoreState(unpopulated_keys_);
+              PopulateCache();
+            }
+          }
+          first = false;
+          if (compare) {
+            fprintf(out_, "== %s, %u threads, %d shard bits ==\n",
+                    cache_type_.c_str(), num_threads_, num_shard_bits_);
+          } else if (sweep) {
+            fprintf(out_, "== %u threads, %d shard bits ==\n", num_threads_,
+                    num_shard_bits_);
+          }
+          RunTests();
+        }
+      }
+    }
+    if (compare) {
+      PrintComparison();
+    }
+
+    if (tracer_ && !tracer_->EndTrace()) {
+      fprintf(stderr, "writing trace file %s failed\n",
+              FLAGS_record_trace.c_str());
+      return false;
+    }
+    if (results_out_ != nullptr) {
+      WriteResults();
+    }
+    return true;
+  }
+
+  // Runs -test_count tests with num_threads_ threads against the current
+  // cache.
+  void RunTests() {
+    Env* env = Env::Default();
     uint32_t test_count = 0;
     while (test_count++ < FLAGS_test_count) {
-			SharedState shared(this);
+			SharedState shared(this, num_threads_);
 			std::vector<ThreadState*> threads(num_threads_);
 			for (uint32_t i = 0; i < num_threads_; i++) {
 				threads[i] = new ThreadState(i, &shared);
@@ -175,36 +935,254 @@ class CacheBench {
 				}
 				// Record start time
 				uint64_t start_time = env->NowMicros();
+				double start_cpu = CpuSeconds();
+				port::ResetMutexContention();
 
 				// Start all threads
 				shared.SetStart();
 				shared.GetCondVar()->SignalAll();
 
-				// Wait threads to complete
+				// Wait threads to complete. Meanwhile sample every
+				// -usage_sample_ms, and stop the threads after -duration_sec.
+				uint64_t interval = static_cast<uint64_t>(FLAGS_usage_sample_ms) * 1000;
+				uint64_t next_sample = start_time + interval;
+				uint64_t deadline =
+				    start_time + static_cast<uint64_t>(FLAGS_duration_sec) * 1000000;
+				std::vector<UsageSample> usage_samples;
+				Progress last = {start_time, 0, 0, 0,
+				                 num_loads.load(std::memory_order_relaxed)};
 				while (!shared.AllDone()) {
-					shared.GetCondVar()->Wait();
+					uint64_t now = env->NowMicros();
+					if (FLAGS_duration_sec > 0 && now >= deadline) {
+						shared.SetStop();
+					}
+					if (interval > 0 && now >= next_sample) {
+						usage_samples.push_back(SampleUsage(threads, start_time, now, &last));
+						PrintUsageSample(usage_samples.back());
+						// Skip the samples a slow wakeup missed.
+						next_sample = std::max(next_sample + interval, now + 1);
+						continue;
+					}
+					uint64_t wakeup = interval > 0 ? next_sample : 0;
+					if (FLAGS_duration_sec > 0 && !shared.Stopped() &&
+					    (wakeup == 0 || deadline < wakeup)) {
+						wakeup = deadline;
+					}
+					if (wakeup == 0) {
+						shared.GetCondVar()->Wait();
+					} else {
+						shared.GetCondVar()->TimedWait(wakeup);
+					}
 				}
 
 				// Record end time
 				uint64_t end_time = env->NowMicros();
+				double cpu = CpuSeconds() - start_cpu;
 				double elapsed = static_cast<double>(end_time - start_time) * 1e-6;
-				uint32_t qps = static_cast<uint32_t>(
-				static_cast<double>(FLAGS_threads * FLAGS_ops_per_thread) / elapsed);
-				fprintf(stdout, "%d Test: complete in %.3f s; QPS = %u\n",
-				        test_count, elapsed, qps);
+				uint64_t ops = shared.GetOps();
+				uint64_t qps = static_cast<uint64_t>(
+				    static_cast<double>(ops) / elapsed);
+				// Includes the value buffer every insert allocates.
+				double allocs_per_op =
+				    static_cast<double>(shared.GetAllocs()) /
+				    static_cast<double>(ops);
+				fprintf(out_,
+				        "%d Test: complete in %.3f s; QPS = %" PRIu64
+				        "; allocs/op = %.3f\n",
+				        test_count, elapsed, qps, allocs_per_op);
+				fprintf(out_, "   cpu = %.3f s (%.0f ns/op)\n", cpu,
+				        cpu * 1e9 / ops);
+				std::vector<double> perf_per_op;
+				if (FLAGS_perf_counters) {
+					perf_per_op = PerfPerOp(shared);
+					PrintPerfCounters(perf_per_op);
+				}
+				if (FLAGS_target_qps_per_thread > 0) {
+					fprintf(out_, "   offered load = %.0f ops/s (%s arrivals)\n",
+					        FLAGS_target_qps_per_thread * num_threads_,
+					        FLAGS_arrival_dist.c_str());
+				}
+				uint64_t lookups = shared.GetLookups();
+				uint64_t hits = shared.GetHits();
+				uint64_t loads = 0;
+				if (FLAGS_loader_latency_us > 0) {
+					loads = num_loads.exchange(0, std::memory_order_relaxed);
+					fprintf(out_, "   loads = %" PRIu64 "\n", loads);
+					hits = lookups > loads ? lookups - loads : 0;
+				}
+				if (lookups > 0) {
+					fprintf(out_, "   hit rate = %.2f%% (%" PRIu64 " lookups)\n",
+					        100.0 * hits / lookups, lookups);
+				}
+				// Loads insert too, and evict like inserts do.
+				uint64_t inserts = shared.GetInserts() + loads;
+				double dropped_per_insert = -1;
+				if (inserts > 0) {
+					// Values dropped by evictions, replacements and erases,
+					// counted where the deleters ran.
+					char dropped[32] = "n/a";
+					if (FLAGS_async_deleter_threads == 0) {
+						dropped_per_insert =
+						    static_cast<double>(shared.GetDeleted()) / inserts;
+						snprintf(dropped, sizeof(dropped), "%.3f",
+						         dropped_per_insert);
+					}
+					fprintf(out_,
+					        "   inserts = %" PRIu64
+					        ", rejected = %.2f%%, dropped/insert = %s\n",
+					        inserts, 100.0 * shared.GetRejected() / inserts,
+					        dropped);
+				}
+				if (typed_cache_) {
+					fprintf(out_, "   usage = %" ROCKSDB_PRIszt "\n",
+					        typed_cache_->GetUsage());
+				} else {
+					fprintf(out_, "   usage = %" ROCKSDB_PRIszt
+					        ", pinned usage = %" ROCKSDB_PRIszt
+					        ", metadata usage = %" ROCKSDB_PRIszt "\n",
+					        cache_->GetUsage(), cache_->GetPinnedUsage(),
+					        cache_->GetMetadataUsage());
+				}
+				size_t max_pinned_usage = PinnedUsage();
+				for (const UsageSample& sample : usage_samples) {
+					max_pinned_usage =
+					    std::max(max_pinned_usage, sample.pinned_usage);
+				}
+				if (!usage_samples.empty()) {
+					fprintf(out_, "   max pinned usage = %" ROCKSDB_PRIszt "\n",
+					        max_pinned_usage);
+				}
+				PrintLatencies(shared.GetLatencies());
+				PrintMutexContention();
+				BenchResult result;
+				result.cache = typed_cache_ ? "TypedCache" : cache_->Name();
+				result.threads = num_threads_;
+				result.shard_bits = num_shard_bits_;
+				result.test = test_count;
+				result.seconds = elapsed;
+				result.ops = ops;
+				result.cpu_seconds = cpu;
+				result.allocs_per_op = allocs_per_op;
+				result.lookups = lookups;
+				result.hits = hits;
+				result.inserts = inserts;
+				result.rejected = shared.GetRejected();
+				result.dropped_per_insert = dropped_per_insert;
+				result.max_pinned_usage = max_pinned_usage;
+				result.latencies = shared.GetLatencies();
+				result.perf_per_op = perf_per_op;
+				result.usage_samples = usage_samples;
+				results_.push_back(result);
 			}
     }
-
-    return true;
   }
 
+
  private:
   std::shared_ptr<Cache> cache_;
+  // Set instead of cache_ with -use_typed_cache.
+  std::unique_ptr<BenchTypedCache> typed_cache_;
+  // Draws the keys of every op, following -key_dist.
+  std::unique_ptr<KeyGenerator> keys_;
+  // keys_'s state before PopulateCache() ran.
+  uint64_t unpopulated_keys_;
+  // With -value_size; what NewValue() draws from.
+  std::unique_ptr<ValueSizeGenerator> value_sizes_;
+  // With -record_trace; cache_ points to it.
+  std::shared_ptr<TracingCache> tracer_;
+  // With -trace_file: the trace. With it or -cache_types: the records each
+  // thread replays.
+  std::unique_ptr<CacheTraceReader> trace_;
+  std::vector<std::vector<const char*>> replay_;
+  // With -cache_types and no -trace_file: the records of each thread,
+  // which replay_ points into.
+  std::vector<std::string> workload_;
+  // The caches to run, and the current one: lru, clock or typed.
+  std::vector<std::string> cache_types_;
+  std::string cache_type_;
+  // The thread counts and shard bits to run with, and the current ones.
+  std::vector<int> sweep_threads_;
+  std::vector<int> sweep_shard_bits_;
   uint32_t num_threads_;
+  int num_shard_bits_;
+  // The text report, and the -output_format results if not text.
+  FILE* out_;
+  FILE* results_out_;
+  // Of every test, for -output_format and -cache_types.
+  std::vector<BenchResult> results_;
+  // Why a perf counter could not be opened, if one could not.
+  std::string perf_error_;
+
+  // Totals of the bench threads at a -usage_sample_ms sample.
+  struct Progress {
+    uint64_t micros;
+    uint64_t ops;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t loads;
+  };
+
+  // Samples the cache now, with the throughput and hit rate since *last,
+  // and moves *last to now.
+  UsageSample SampleUsage(const std::vector<ThreadState*>& threads,
+                          uint64_t start_time, uint64_t now,
+                          Progress* last) const {
+    Progress current = {now, 0, 0, 0,
+                        num_loads.load(std::memory_order_relaxed)};
+    for (const ThreadState* thread : threads) {
+      current.ops += thread->ops;
+      current.lookups += thread->lookups;
+      current.hits += thread->hits;
+    }
+    UsageSample sample;
+    sample.seconds = static_cast<double>(now - start_time) * 1e-6;
+    sample.usage = Usage();
+    sample.pinned_usage = PinnedUsage();
+    double seconds = static_cast<double>(now - last->micros) * 1e-6;
+    sample.ops_per_sec = (current.ops - last->ops) / seconds;
+    uint64_t lookups = current.lookups - last->lookups;
+    uint64_t hits = current.hits - last->hits;
+    if (FLAGS_loader_latency_us > 0) {
+      uint64_t loads = current.loads - last->loads;
+      hits = lookups > loads ? lookups - loads : 0;
+    }
+    sample.hit_rate =
+        lookups > 0 ? static_cast<double>(hits) / lookups : -1;
+    sample.shard_skew = ShardSkew();
+    *last = current;
+    return sample;
+  }
+
+  void PrintUsageSample(const UsageSample& sample) const {
+    char hit_rate[32] = "n/a";
+    if (sample.hit_rate >= 0) {
+      snprintf(hit_rate, sizeof(hit_rate), "%.2f%%", sample.hit_rate * 100);
+    }
+    fprintf(out_,
+            "   %8.3f s: usage = %" ROCKSDB_PRIszt
+            ", pinned usage = %" ROCKSDB_PRIszt
+            ", %.0f ops/s, hit rate = %s, shard skew = %.2f\n",
+            sample.seconds, sample.usage, sample.pinned_usage,
+            sample.ops_per_sec, hit_rate, sample.shard_skew);
+    fflush(out_);
+  }
+
+  // Whether thread should run its op i: -ops_per_thread ops, or ops until
+  // -duration_sec is up.
+  static bool KeepRunning(const ThreadState* thread, uint64_t i) {
+    if (FLAGS_duration_sec > 0) {
+      return !thread->shared->Stopped();
+    }
+    return i < FLAGS_ops_per_thread;
+  }
 
   static void ThreadBody(void* v) {
     ThreadState* thread = reinterpret_cast<ThreadState*>(v);
     SharedState* shared = thread->shared;
+    if (FLAGS_perf_counters) {
+      std::string error;
+      thread->perf.Open(&error);
+    }
 
     {
       MutexLock l(shared->GetMutex());
@@ -216,10 +1194,21 @@ class CacheBench {
         shared->GetCondVar()->Wait();
       }
     }
+    uint64_t allocs_before = ThreadAllocations();
+    uint64_t deleted_before = tls_num_deleted;
+    thread->perf.Start();
     thread->shared->GetCacheBench()->OperateCache(thread);
+    thread->perf.Stop();
+    shared->AddAllocs(ThreadAllocations() - allocs_before);
+    shared->AddOps(thread->ops);
+    shared->AddLookups(thread->lookups, thread->hits);
+    shared->AddInserts(thread->inserts, thread->rejected,
+                       tls_num_deleted - deleted_before);
 
     {
       MutexLock l(shared->GetMutex());
+      shared->MergeLatencies(thread->latencies);
+      shared->MergePerfCounters(thread->perf);
       shared->IncDone();
       if (shared->AllDone()) {
         shared->GetCondVar()->SignalAll();
@@ -227,42 +1216,717 @@ class CacheBench {
     }
   }
 
+  // The start of an op, for RecordOp(). Free without -histogram.
+  static uint64_t StartOp() {
+    return FLAGS_histogram ? CycleClock::Now() : 0;
+  }
+
+  static void RecordOp(ThreadState* thread, OpType type, uint64_t start) {
+    if (FLAGS_histogram) {
+      thread->latencies[type].Add(CycleClock::Now() - start);
+    }
+  }
+
+  // Scoped to one op, which it counts. In an open-loop run it also paces
+  // the op: the constructor waits for the op's intended start, the
+  // destructor records the op's latency from that start. Measuring from when
+  // the op should have started, rather than when a delayed thread got to it,
+  // keeps ops queued behind a slow one from being left out of the tail
+  // (coordinated omission).
+  class ScheduledOp {
+   public:
+    explicit ScheduledOp(ThreadState* thread) : thread_(thread) {
+      if (FLAGS_target_qps_per_thread > 0) {
+        WaitForArrival(thread_);
+      }
+    }
+    ~ScheduledOp() {
+      thread_->ops++;
+      if (FLAGS_target_qps_per_thread > 0 && FLAGS_histogram) {
+        thread_->latencies[kOpScheduled].Add(CycleClock::Now() -
+                                             thread_->intended_start);
+      }
+    }
+
+   private:
+    ThreadState* thread_;
+  };
+
+  // Sets thread->intended_start to the next arrival and waits for it, unless
+  // the thread is already late. The schedule never slips: a late thread
+  // issues its queued ops back to back until it catches up.
+  static void WaitForArrival(ThreadState* thread) {
+    uint64_t now = CycleClock::Now();
+    if (thread->next_arrival == 0) {
+      thread->next_arrival = now;
+    }
+    thread->intended_start = thread->next_arrival;
+    double mean_gap =
+        1e9 / FLAGS_target_qps_per_thread / CycleClock::NanosPerTick();
+    double gap = mean_gap;
+    if (FLAGS_arrival_dist == "poisson") {
+      // Uniform in (0, 1], so the log is finite.
+      double u = (thread->rnd.Next() + 1.0) / 2147483648.0;
+      gap = -log(u) * mean_gap;
+    }
+    thread->next_arrival += static_cast<uint64_t>(gap);
+
+    uint64_t start = thread->intended_start;
+    if (now >= start) {
+      return;
+    }
+    // The wait is not part of any op: keep its spinning and the context
+    // switches of its sleep out of the per-op counts.
+    thread->perf.Stop();
+    // Sleep through most of a long wait, then spin for the rest, since a
+    // sleep can overshoot by tens of microseconds.
+    double wait_ns = (start - now) * CycleClock::NanosPerTick();
+    if (wait_ns > 100000) {
+      std::this_thread::sleep_for(
+          std::chrono::nanoseconds(static_cast<int64_t>(wait_ns) - 50000));
+    }
+    while (CycleClock::Now() < start) {
+      port::AsmVolatilePause();
+    }
+    thread->perf.Start();
+  }
+
+  // The perf counters of shared per op, or -1 for the ones some thread
+  // could not count.
+  std::vector<double> PerfPerOp(const SharedState& shared) const {
+    std::vector<double> per_op(PerfCounters::kNumCounters, -1);
+    for (int i = 0; i < PerfCounters::kNumCounters; i++) {
+      if (shared.PerfCounterAvailable(i)) {
+        per_op[i] = static_cast<double>(shared.GetPerfCounter(i)) / shared.GetOps();
+      }
+    }
+    return per_op;
+  }
+
+  void PrintPerfCounters(const std::vector<double>& per_op) const {
+    fprintf(out_, "   per op:");
+    for (int i = 0; i < PerfCounters::kNumCounters; i++) {
+      if (per_op[i] >= 0) {
+        fprintf(out_, " %s %.4g", PerfCounters::Name(i), per_op[i]);
+      } else {
+        fprintf(out_, " %s n/a", PerfCounters::Name(i));
+      }
+    }
+    if (per_op[PerfCounters::kCycles] > 0 &&
+        per_op[PerfCounters::kInstructions] >= 0) {
+      fprintf(out_, " ipc %.2f",
+              per_op[PerfCounters::kInstructions] /
+                  per_op[PerfCounters::kCycles]);
+    }
+    fprintf(out_, "\n");
+  }
+
+  // For builds with ROCKSDB_MUTEX_CONTENTION_PROFILE: per profiled mutex site,
+  // how often its mutexes were taken, what share of those had to wait and for
+  // how long, and how much busier the busiest instance (shard) was than the
+  // mean; then the same per instance.
+  void PrintMutexContention() const {
+    std::vector<port::MutexContention> counts = port::GetMutexContention();
+    size_t i = 0;
+    while (i < counts.size()) {
+      const char* site = counts[i].site;
+      uint64_t acquisitions = 0;
+      uint64_t contended = 0;
+      uint64_t wait_nanos = 0;
+      uint64_t busiest = 0;
+      size_t end = i;
+      for (; end < counts.size() && strcmp(counts[end].site, site) == 0;
+           end++) {
+        acquisitions += counts[end].acquisitions;
+        contended += counts[end].contended;
+        wait_nanos += counts[end].wait_nanos;
+        busiest = std::max(busiest, counts[end].acquisitions);
+      }
+      if (acquisitions > 0) {
+        double mean = static_cast<double>(acquisitions) / (end - i);
+        fprintf(out_,
+                "   %s: %" PRIu64 " locks, %.2f%% contended, wait %.3f ms, "
+                "busiest instance %.2fx the mean\n",
+                site, acquisitions, 100.0 * contended / acquisitions,
+                wait_nanos * 1e-6, busiest / mean);
+        for (size_t k = i; k < end; k++) {
+          const port::MutexContention& c = counts[k];
+          if (c.acquisitions == 0) {
+            continue;
+          }
+          fprintf(out_,
+                  "      [%d] %" PRIu64 " locks, %.2f%% contended, "
+                  "%.0f ns avg wait\n",
+                  c.instance, c.acquisitions,
+                  100.0 * c.contended / c.acquisitions,
+                  c.contended > 0
+                      ? static_cast<double>(c.wait_nanos) / c.contended
+                      : 0.0);
+        }
+      }
+      i = end;
+    }
+  }
+
+  // User plus system time of the process so far.
+  static double CpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+  }
+
+  size_t Usage() const {
+    return typed_cache_ ? typed_cache_->GetUsage() : cache_->GetUsage();
+  }
+
+  // TypedCache does not track its pinned usage.
+  size_t PinnedUsage() const {
+    return typed_cache_ ? 0 : cache_->GetPinnedUsage();
+  }
+
+  // The largest shard usage over the mean one.
+  double ShardSkew() const {
+    std::vector<size_t> usage;
+    if (typed_cache_) {
+      typed_cache_->GetShardUsage(&usage);
+    } else {
+      cache_->GetShardUsage(&usage);
+    }
+    size_t total = 0;
+    size_t max = 0;
+    for (size_t u : usage) {
+      total += u;
+      max = std::max(max, u);
+    }
+    return total > 0 ? static_cast<double>(max) * usage.size() / total : 1;
+  }
+
+  // With -cache_types: one row per test, so the caches can be compared at a
+  // glance.
+  void PrintComparison() const {
+    double nanos_per_tick = FLAGS_histogram ? CycleClock::NanosPerTick() : 0;
+    // Percentile p of a latency histogram in ns, or "-" if it is empty.
+    auto percentile = [nanos_per_tick](const LatencyHistogram& h, double p) {
+      char buf[32] = "-";
+      if (h.Count() > 0) {
+        snprintf(buf, sizeof(buf), "%.0f", h.Percentile(p) * nanos_per_tick);
+      }
+      return std::string(buf);
+    };
+    fprintf(out_, "== comparison ==\n");
+    fprintf(out_, "%-12s %7s %10s %4s %12s %9s %8s %11s %11s %11s\n", "cache",
+            "threads", "shard bits", "test", "QPS", "cpu ns/op", "hit rate",
+            "lookup p50", "lookup p99", "insert p99");
+    for (const BenchResult& r : results_) {
+      LatencyHistogram lookup;
+      LatencyHistogram insert;
+      if (!r.latencies.empty()) {
+        lookup.Merge(r.latencies[kOpLookupHit]);
+        lookup.Merge(r.latencies[kOpLookupMiss]);
+        insert.Merge(r.latencies[kOpInsert]);
+      }
+      char hit_rate[16] = "-";
+      if (r.lookups > 0) {
+        snprintf(hit_rate, sizeof(hit_rate), "%.2f%%",
+                 100.0 * r.hits / r.lookups);
+      }
+      fprintf(out_, "%-12s %7u %10d %4d %12.0f %9.0f %8s %11s %11s %11s\n",
+              r.cache.c_str(), r.threads, r.shard_bits, r.test,
+              r.ops / r.seconds, r.cpu_seconds * 1e9 / r.ops, hit_rate,
+              percentile(lookup, 50).c_str(), percentile(lookup, 99).c_str(),
+              percentile(insert, 99).c_str());
+    }
+  }
+
+  void PrintLatencies(const std::vector<LatencyHistogram>& latencies) const {
+    double nanos_per_tick = CycleClock::NanosPerTick();
+    for (size_t i = 0; i < latencies.size(); i++) {
+      if (latencies[i].Count() > 0) {
+        fprintf(out_, "   %-14s (ns): %s\n", kOpTypeNames[i],
+                latencies[i].ToString(nanos_per_tick).c_str());
+      }
+    }
+  }
+
+  // Inserts value with deleter, timed. With -strict_capacity_limit the
+  // insert takes a handle: without one a value that does not fit is dropped
+  // as if evicted at once, and the insert does not fail.
+  template <typename Key>
+  void InsertValue(ThreadState* thread, const Key& key, char* value,
+                   size_t charge, Cache::Priority priority) {
+    thread->inserts++;
+    Cache::Handle* handle = nullptr;
+    uint64_t start = StartOp();
+    bool inserted =
+        cache_->Insert(key, value, charge, &deleter,
+                       FLAGS_strict_capacity_limit ? &handle : nullptr,
+                       priority);
+    RecordOp(thread, kOpInsert, start);
+    if (!FLAGS_strict_capacity_limit) {
+      return;
+    }
+    if (inserted) {
+      cache_->Release(handle);
+    } else {
+      thread->rejected++;
+      delete[] value;
+    }
+  }
+
   void OperateCache(ThreadState* thread) {
-    for (uint64_t i = 0; i < FLAGS_ops_per_thread; i++) {
-      uint64_t rand_key = thread->rnd.Next() % FLAGS_max_key;
+    if (!replay_.empty()) {
+      ReplayTrace(thread);
+      return;
+    }
+    if (typed_cache_) {
+      OperateTypedCache(thread);
+      return;
+    }
+    for (uint64_t i = 0; KeepRunning(thread, i); i++) {
+      ScheduledOp scheduled(thread);
+      uint64_t rand_key = keys_->Next(&thread->rnd);
       // Cast uint64* to be char*, data would be copied to cache
       Slice key(reinterpret_cast<char*>(&rand_key), 8);
       int32_t prob_op = thread->rnd.Uniform(100);
       if (prob_op >= 0 && prob_op < FLAGS_insert_percent) {
         // do insert
-        cache_->Insert(key, new char[10], 1, &deleter);
+        rand_key = keys_->InsertKey(rand_key);
+        size_t charge;
+        char* value = NewValue(&thread->rnd, &charge);
+        InsertValue(thread, key, value, charge, Cache::Priority::LOW);
       } else if (prob_op -= FLAGS_insert_percent &&
                  prob_op < FLAGS_lookup_percent) {
         // do lookup
+        if (FLAGS_loader_latency_us > 0) {
+          uint64_t start = StartOp();
+          LoadingLookup(thread, rand_key);
+          RecordOp(thread, kOpLoadingLookup, start);
+          continue;
+        }
+        if (FLAGS_multi_lookup_batch > 1) {
+          MultiLookup(thread, rand_key);
+          continue;
+        }
+        if (FLAGS_use_get_copy) {
+          size_t value_size = 0;
+          thread->lookups++;
+          uint64_t start = StartOp();
+          bool found =
+              cache_->GetCopy(key, &ValueLength, thread->copy_buf.data(),
+                              thread->copy_buf.size(), &value_size);
+          RecordOp(thread, found ? kOpLookupHit : kOpLookupMiss, start);
+          if (!found && value_size > thread->copy_buf.size()) {
+            // Found, but too large to copy; the next one will fit.
+            thread->copy_buf.resize(value_size);
+            found = true;
+          }
+          if (found) {
+            thread->hits++;
+          }
+          continue;
+        }
+        uint64_t start = StartOp();
         auto handle = cache_->Lookup(key);
+        RecordOp(thread, handle ? kOpLookupHit : kOpLookupMiss, start);
+        thread->lookups++;
         if (handle) {
+          thread->hits++;
+          start = StartOp();
           cache_->Release(handle);
+          RecordOp(thread, kOpRelease, start);
         }
       } else if (prob_op -= FLAGS_lookup_percent &&
                  prob_op < FLAGS_erase_percent) {
         // do erase
+        uint64_t start = StartOp();
         cache_->Erase(key);
+        RecordOp(thread, kOpErase, start);
       }
     }
   }
 
+  // Run the trace records LoadTrace() gave to thread, in order. Lookups
+  // release their handle at once; inserted values are like the ones
+  // OperateCache() inserts, with the traced charge.
+  void ReplayTrace(ThreadState* thread) {
+    for (const char* p : replay_[thread->tid]) {
+      if (FLAGS_duration_sec > 0 && thread->shared->Stopped()) {
+        break;
+      }
+      ScheduledOp scheduled(thread);
+      CacheTraceRecord record = CacheTraceRecord::Decode(p);
+      HashedKey key(record.key, record.hash);
+      switch (record.op) {
+        case kTraceInsert: {
+          InsertValue(thread, key, ReplayedValue(record.charge),
+                      record.charge, record.priority);
+          break;
+        }
+        case kTraceLookup: {
+          uint64_t start = StartOp();
+          auto handle = cache_->Lookup(key);
+          RecordOp(thread, handle ? kOpLookupHit : kOpLookupMiss, start);
+          thread->lookups++;
+          if (handle) {
+            thread->hits++;
+            start = StartOp();
+            cache_->Release(handle);
+            RecordOp(thread, kOpRelease, start);
+          }
+          break;
+        }
+        case kTraceErase: {
+          uint64_t start = StartOp();
+          cache_->Erase(key);
+          RecordOp(thread, kOpErase, start);
+          break;
+        }
+      }
+    }
+  }
+
+  // OperateCache() against typed_cache_: the same op mix, with the key
+  // used as is rather than wrapped in a Slice.
+  void OperateTypedCache(ThreadState* thread) {
+    for (uint64_t i = 0; KeepRunning(thread, i); i++) {
+      ScheduledOp scheduled(thread);
+      uint64_t key = keys_->Next(&thread->rnd);
+      int32_t prob_op = thread->rnd.Uniform(100);
+      if (prob_op >= 0 && prob_op < FLAGS_insert_percent) {
+        key = keys_->InsertKey(key);
+        size_t charge;
+        BenchValue value(NewValue(&thread->rnd, &charge));
+        thread->inserts++;
+        uint64_t start = StartOp();
+        typed_cache_->Insert(key, std::move(value), charge);
+        RecordOp(thread, kOpInsert, start);
+      } else if (prob_op -= FLAGS_insert_percent &&
+                 prob_op < FLAGS_lookup_percent) {
+        uint64_t start = StartOp();
+        auto handle = typed_cache_->Lookup(key);
+        RecordOp(thread, handle ? kOpLookupHit : kOpLookupMiss, start);
+        thread->lookups++;
+        if (handle) {
+          thread->hits++;
+          start = StartOp();
+          typed_cache_->Release(handle);
+          RecordOp(thread, kOpRelease, start);
+        }
+      } else if (prob_op -= FLAGS_lookup_percent &&
+                 prob_op < FLAGS_erase_percent) {
+        uint64_t start = StartOp();
+        typed_cache_->Erase(key);
+        RecordOp(thread, kOpErase, start);
+      }
+    }
+  }
+
+  // Look up first_key, loading it on a miss. Inline through GetOrCreate(),
+  // or with -async_lookup_batch as a batch of LookupAsync() calls, for
+  // first_key and more random keys, that are waited on together.
+  void LoadingLookup(ThreadState* thread, uint64_t first_key) {
+    if (FLAGS_async_lookup_batch <= 0) {
+      thread->lookups++;
+      Slice key(reinterpret_cast<char*>(&first_key), 8);
+      auto handle = cache_->GetOrCreate(key, SimulatedLoad, &deleter);
+      if (handle) {
+        cache_->Release(handle);
+      }
+      return;
+    }
+    std::vector<std::future<Cache::Handle*>>& pending =
+        thread->pending_lookups;
+    pending.clear();
+    uint64_t key_data = first_key;
+    for (int j = 0; j < FLAGS_async_lookup_batch; j++) {
+      if (j > 0) {
+        key_data = keys_->Next(&thread->rnd);
+      }
+      thread->lookups++;
+      Slice key(reinterpret_cast<char*>(&key_data), 8);
+      pending.push_back(LookupAsync(cache_, key, SimulatedLoad, &deleter));
+    }
+    for (auto& result : pending) {
+      Cache::Handle* handle = result.get();
+      if (handle) {
+        cache_->Release(handle);
+      }
+    }
+  }
+
+  // Look up first_key and FLAGS_multi_lookup_batch - 1 more random keys in
+  // one MultiLookup() call.
+  void MultiLookup(ThreadState* thread, uint64_t first_key) {
+    size_t n = static_cast<size_t>(FLAGS_multi_lookup_batch);
+    std::vector<uint64_t>& key_data = thread->multi_key_data;
+    std::vector<Slice>& keys = thread->multi_keys;
+    std::vector<Cache::Handle*>& handles = thread->multi_handles;
+    key_data.resize(n);
+    keys.resize(n);
+    handles.resize(n);
+    key_data[0] = first_key;
+    for (size_t j = 1; j < n; j++) {
+      key_data[j] = keys_->Next(&thread->rnd);
+    }
+    for (size_t j = 0; j < n; j++) {
+      keys[j] = Slice(reinterpret_cast<char*>(&key_data[j]), 8);
+    }
+    uint64_t start = StartOp();
+    cache_->MultiLookup(keys.data(), n, handles.data());
+    RecordOp(thread, kOpMultiLookup, start);
+    // Each key counts as an op, like n separate lookups would; ScheduledOp
+    // counts the first.
+    thread->ops += n - 1;
+    thread->lookups += n;
+    for (size_t j = 0; j < n; j++) {
+      if (handles[j]) {
+        thread->hits++;
+        cache_->Release(handles[j]);
+      }
+    }
+  }
+
+  // Writes results_ to results_out_ as -output_format.
+  void WriteResults() const {
+    double nanos_per_tick = CycleClock::NanosPerTick();
+    static const double kPercentiles[] = {50, 99, 99.9, 99.99};
+    static const char* const kPercentileNames[] = {"p50", "p99", "p99.9",
+                                                   "p99.99"};
+    FILE* out = results_out_;
+    bool json = FLAGS_output_format == "json";
+    if (json) {
+      fprintf(out, "[\n");
+    } else {
+      fprintf(out,
+              "cache,threads,shard_bits,test,seconds,ops,qps,cpu_seconds,"
+              "cpu_ns_per_op,allocs_per_op,lookups,hit_rate,inserts,"
+              "rejected,dropped_per_insert,max_pinned_usage");
+      for (int t = 0; t < kNumOpTypes; t++) {
+        std::string op = OpTypeKey(t);
+        fprintf(out, ",%s_count,%s_avg_ns", op.c_str(), op.c_str());
+        for (const char* name : kPercentileNames) {
+          fprintf(out, ",%s_%s_ns", op.c_str(), name);
+        }
+        fprintf(out, ",%s_max_ns", op.c_str());
+      }
+      if (FLAGS_perf_counters) {
+        for (int c = 0; c < PerfCounters::kNumCounters; c++) {
+          fprintf(out, ",%s_per_op", PerfCounters::Name(c));
+        }
+      }
+      fprintf(out, "\n");
+    }
+    for (size_t i = 0; i < results_.size(); i++) {
+      const BenchResult& r = results_[i];
+      double qps = r.ops / r.seconds;
+      double cpu_ns_per_op = r.cpu_seconds * 1e9 / r.ops;
+      double hit_rate =
+          r.lookups > 0 ? static_cast<double>(r.hits) / r.lookups : 0;
+      if (json) {
+        fprintf(out,
+                "  {\"cache\": \"%s\", \"threads\": %u, \"shard_bits\": %d, "
+                "\"test\": %d, \"seconds\": %.6f, \"ops\": %" PRIu64
+                ", \"qps\": %.0f, \"cpu_seconds\": %.6f, "
+                "\"cpu_ns_per_op\": %.1f, \"allocs_per_op\": %.3f, "
+                "\"lookups\": %" PRIu64 ", \"hit_rate\": %.6f, "
+                "\"inserts\": %" PRIu64 ", \"rejected\": %" PRIu64 ", ",
+                r.cache.c_str(), r.threads, r.shard_bits, r.test, r.seconds,
+                r.ops, qps, r.cpu_seconds, cpu_ns_per_op, r.allocs_per_op,
+                r.lookups, hit_rate, r.inserts, r.rejected);
+        if (r.dropped_per_insert >= 0) {
+          fprintf(out, "\"dropped_per_insert\": %.6f, ", r.dropped_per_insert);
+        }
+        fprintf(out,
+                "\"max_pinned_usage\": %" ROCKSDB_PRIszt ", \"latency_ns\": {",
+                r.max_pinned_usage);
+        bool first = true;
+        for (size_t t = 0; t < r.latencies.size(); t++) {
+          const LatencyHistogram& h = r.latencies[t];
+          if (h.Count() == 0) {
+            continue;
+          }
+          fprintf(out, "%s\"%s\": {\"count\": %" PRIu64 ", \"avg\": %.0f",
+                  first ? "" : ", ", OpTypeKey(t).c_str(), h.Count(),
+                  h.Average() * nanos_per_tick);
+          for (size_t k = 0; k < 4; k++) {
+            fprintf(out, ", \"%s\": %.0f", kPercentileNames[k],
+                    h.Percentile(kPercentiles[k]) * nanos_per_tick);
+          }
+          fprintf(out, ", \"max\": %.0f}", h.Max() * nanos_per_tick);
+          first = false;
+        }
+        fprintf(out, "}");
+        if (!r.perf_per_op.empty()) {
+          fprintf(out, ", \"perf_per_op\": {");
+          first = true;
+          for (int c = 0; c < PerfCounters::kNumCounters; c++) {
+            if (r.perf_per_op[c] >= 0) {
+              fprintf(out, "%s\"%s\": %.6g", first ? "" : ", ",
+                      PerfCounters::Name(c), r.perf_per_op[c]);
+              first = false;
+            }
+          }
+          fprintf(out, "}");
+        }
+        if (!r.usage_samples.empty()) {
+          fprintf(out, ", \"usage_samples\": [");
+          for (size_t k = 0; k < r.usage_samples.size(); k++) {
+            const UsageSample& sample = r.usage_samples[k];
+            fprintf(out,
+                    "%s{\"seconds\": %.3f, \"usage\": %" ROCKSDB_PRIszt
+                    ", \"pinned_usage\": %" ROCKSDB_PRIszt
+                    ", \"ops_per_sec\": %.0f, ",
+                    k > 0 ? ", " : "", sample.seconds, sample.usage,
+                    sample.pinned_usage, sample.ops_per_sec);
+            if (sample.hit_rate >= 0) {
+              fprintf(out, "\"hit_rate\": %.6f, ", sample.hit_rate);
+            }
+            fprintf(out, "\"shard_skew\": %.3f}", sample.shard_skew);
+          }
+          fprintf(out, "]");
+        }
+        fprintf(out, "}%s\n", i + 1 < results_.size() ? "," : "");
+      } else {
+        fprintf(out,
+                "%s,%u,%d,%d,%.6f,%" PRIu64 ",%.0f,%.6f,%.1f,%.3f,%" PRIu64
+                ",%.6f",
+                r.cache.c_str(), r.threads, r.shard_bits, r.test, r.seconds,
+                r.ops, qps, r.cpu_seconds, cpu_ns_per_op, r.allocs_per_op,
+                r.lookups, hit_rate);
+        fprintf(out, ",%" PRIu64 ",%" PRIu64 ",", r.inserts, r.rejected);
+        if (r.dropped_per_insert >= 0) {
+          fprintf(out, "%.6f", r.dropped_per_insert);
+        }
+        fprintf(out, ",%" ROCKSDB_PRIszt, r.max_pinned_usage);
+        for (int t = 0; t < kNumOpTypes; t++) {
+          if (static_cast<size_t>(t) >= r.latencies.size() ||
+              r.latencies[t].Count() == 0) {
+            fprintf(out, ",0,,,,,,");
+            continue;
+          }
+          const LatencyHistogram& h = r.latencies[t];
+          fprintf(out, ",%" PRIu64 ",%.0f", h.Count(),
+                  h.Average() * nanos_per_tick);
+          for (double p : kPercentiles) {
+            fprintf(out, ",%.0f", h.Percentile(p) * nanos_per_tick);
+          }
+          fprintf(out, ",%.0f", h.Max() * nanos_per_tick);
+        }
+        for (double count : r.perf_per_op) {
+          if (count >= 0) {
+            fprintf(out, ",%.6g", count);
+          } else {
+            fprintf(out, ",");
+          }
+        }
+        fprintf(out, "\n");
+      }
+    }
+    if (json) {
+      fprintf(out, "]\n");
+    }
+    fflush(out);
+  }
+
+  // kOpTypeNames[type] with underscores, for json keys and csv columns.
+  static std::string OpTypeKey(size_t type) {
+    std::string key = kOpTypeNames[type];
+    std::replace(key.begin(), key.end(), ' ', '_');
+    return key;
+  }
+
   void PrintEnv() const {
-    printf("Number of threads   : %d\n", FLAGS_threads);
-    printf("Ops per thread      : %" PRIu64 "\n", FLAGS_ops_per_thread);
-    printf("Cache size          : %" PRIu64 "\n", FLAGS_cache_size);
-    printf("Num shard bits      : %d\n", FLAGS_num_shard_bits);
-    printf("Max key             : %" PRIu64 "\n", FLAGS_max_key);
-    printf("Populate cache      : %d\n", FLAGS_populate_cache);
-    printf("Insert percentage   : %d%%\n", FLAGS_insert_percent);
-    printf("Lookup percentage   : %d%%\n", FLAGS_lookup_percent);
-    printf("Erase percentage    : %d%%\n", FLAGS_erase_percent);
-		printf("Test count          : %d\n", FLAGS_test_count);
-		printf("----------------------------\n");
+    if (sweep_threads_.size() > 1) {
+      fprintf(out_, "Number of threads   : %s\n", FLAGS_sweep_threads.c_str());
+    } else {
+      fprintf(out_, "Number of threads   : %u\n", num_threads_);
+    }
+    if (FLAGS_duration_sec > 0) {
+      fprintf(out_, "Duration            : %d s\n", FLAGS_duration_sec);
+    } else {
+      fprintf(out_, "Ops per thread      : %" PRIu64 "\n", FLAGS_ops_per_thread);
+    }
+    fprintf(out_, "Cache size          : %" PRIu64 "\n", FLAGS_cache_size);
+    fprintf(out_, "Strict capacity     : %d\n", FLAGS_strict_capacity_limit);
+    if (FLAGS_value_size > 0) {
+      fprintf(out_, "Value size          : %d (%s", FLAGS_value_size,
+              FLAGS_value_size_dist.c_str());
+      if (FLAGS_value_size_dist == "lognormal") {
+        fprintf(out_, ", sigma %.2f", FLAGS_value_size_sigma);
+      } else if (FLAGS_value_size_dist == "bimodal") {
+        fprintf(out_, ", %.0f%% %.0fx larger", FLAGS_bimodal_large_fraction * 100,
+                FLAGS_bimodal_large_ratio);
+      }
+      fprintf(out_, ")\n");
+    } else {
+      fprintf(out_, "Value size          : 10 (charged 1)\n");
+    }
+    if (sweep_shard_bits_.size() > 1) {
+      fprintf(out_, "Num shard bits      : %s\n",
+              FLAGS_sweep_shard_bits.c_str());
+    } else {
+      fprintf(out_, "Num shard bits      : %d\n", num_shard_bits_);
+    }
+    fprintf(out_, "Max key             : %" PRIu64 "\n", FLAGS_max_key);
+    fprintf(out_, "Key distribution    : %s", FLAGS_key_dist.c_str());
+    if (FLAGS_key_dist == "hotspot") {
+      fprintf(out_, " (%.0f%% of ops on %.0f%% of keys)",
+             FLAGS_hotspot_op_fraction * 100, FLAGS_hotspot_set_fraction * 100);
+    } else if (FLAGS_key_dist != "uniform") {
+      fprintf(out_, " (theta %.2f)", FLAGS_zipf_theta);
+    }
+    fprintf(out_, "\n");
+    fprintf(out_, "Populate cache      : %d\n", FLAGS_populate_cache);
+    fprintf(out_, "Populate batch      : %d\n", FLAGS_populate_batch);
+    fprintf(out_, "Insert percentage   : %d%%\n", FLAGS_insert_percent);
+    fprintf(out_, "Lookup percentage   : %d%%\n", FLAGS_lookup_percent);
+    fprintf(out_, "Multi lookup batch  : %d\n", FLAGS_multi_lookup_batch);
+    fprintf(out_, "Use GetCopy         : %d\n", FLAGS_use_get_copy);
+    fprintf(out_, "Loader latency      : %d us (%s)\n", FLAGS_loader_latency_us,
+           FLAGS_loader_latency_dist.c_str());
+    fprintf(out_, "Async lookup batch  : %d\n", FLAGS_async_lookup_batch);
+    fprintf(out_, "Erase percentage    : %d%%\n", FLAGS_erase_percent);
+    fprintf(out_, "Async deleters      : %d\n", FLAGS_async_deleter_threads);
+    fprintf(out_, "Metadata charged    : %d\n", FLAGS_metadata_charged);
+    fprintf(out_, "Huge page arena     : %d\n", FLAGS_use_huge_page_arena);
+    fprintf(out_, "Typed cache         : %d\n", FLAGS_use_typed_cache);
+    if (!FLAGS_cache_types.empty()) {
+      fprintf(out_, "Cache types         : %s (identical ops)\n",
+              FLAGS_cache_types.c_str());
+    }
+    fprintf(out_, "Histogram           : %d\n", FLAGS_histogram);
+    fprintf(out_, "Mutex profile       : %d\n", port::kMutexContentionProfile);
+    if (FLAGS_usage_sample_ms > 0) {
+      fprintf(out_, "Usage sampling      : every %d ms\n", FLAGS_usage_sample_ms);
+    }
+    fprintf(out_, "Perf counters       : %d", FLAGS_perf_counters);
+    if (!perf_error_.empty()) {
+      fprintf(out_, " (%s)", perf_error_.c_str());
+    }
+    fprintf(out_, "\n");
+    if (FLAGS_target_qps_per_thread > 0) {
+      fprintf(out_, "Target QPS/thread   : %.0f (%s)\n", FLAGS_target_qps_per_thread,
+             FLAGS_arrival_dist.c_str());
+    } else {
+      fprintf(out_, "Target QPS/thread   : closed loop\n");
+    }
+    if (trace_) {
+      fprintf(out_, "Trace file          : %s (%" PRIu64 " ops, %" ROCKSDB_PRIszt
+             " traced threads)\n",
+             FLAGS_trace_file.c_str(), trace_->NumRecords(),
+             trace_->NumThreads());
+    }
+    if (tracer_) {
+      fprintf(out_, "Record trace        : %s\n", FLAGS_record_trace.c_str());
+    }
+    if (results_out_ != nullptr) {
+      fprintf(out_, "Output              : %s to %s\n",
+              FLAGS_output_format.c_str(),
+              FLAGS_output_file.empty() ? "stdout" : FLAGS_output_file.c_str());
+    }
+		fprintf(out_, "Test count          : %d\n", FLAGS_test_count);
+		fprintf(out_, "----------------------------\n");
   }
 };
 }  // namespace rocksdb
@@ -275,6 +1939,130 @@ int main(int argc, char** argv) {
     exit(1);
   }
 
+  rocksdb::KeyGenerator::Distribution key_dist;
+  if (!rocksdb::KeyGenerator::ParseDistribution(FLAGS_key_dist, &key_dist)) {
+    fprintf(stderr, "unknown key distribution %s\n", FLAGS_key_dist.c_str());
+    exit(1);
+  }
+  if (key_dist != rocksdb::KeyGenerator::kUniform &&
+      key_dist != rocksdb::KeyGenerator::kHotspot &&
+      (FLAGS_zipf_theta <= 0 || FLAGS_zipf_theta >= 1)) {
+    fprintf(stderr, "zipf_theta must be in (0, 1)\n");
+    exit(1);
+  }
+
+  if (FLAGS_loader_latency_dist != "fixed" &&
+      FLAGS_loader_latency_dist != "uniform" &&
+      FLAGS_loader_latency_dist != "exponential") {
+    fprintf(stderr, "unknown loader latency distribution %s\n",
+            FLAGS_loader_latency_dist.c_str());
+    exit(1);
+  }
+  std::vector<int> sweep;
+  if (!FLAGS_sweep_threads.empty() &&
+      (!rocksdb::ParseIntList(FLAGS_sweep_threads, &sweep) ||
+       *std::min_element(sweep.begin(), sweep.end()) <= 0)) {
+    fprintf(stderr, "bad sweep_threads %s\n", FLAGS_sweep_threads.c_str());
+    exit(1);
+  }
+  if (!FLAGS_sweep_shard_bits.empty() &&
+      (!rocksdb::ParseIntList(FLAGS_sweep_shard_bits, &sweep) ||
+       *std::min_element(sweep.begin(), sweep.end()) < 0 ||
+       *std::max_element(sweep.begin(), sweep.end()) > 19)) {
+    fprintf(stderr, "bad sweep_shard_bits %s\n",
+            FLAGS_sweep_shard_bits.c_str());
+    exit(1);
+  }
+  if (!FLAGS_record_trace.empty() &&
+      (!FLAGS_sweep_threads.empty() || !FLAGS_sweep_shard_bits.empty())) {
+    fprintf(stderr, "record_trace traces a single run, not a sweep\n");
+    exit(1);
+  }
+  if (FLAGS_output_format != "text" && FLAGS_output_format != "json" &&
+      FLAGS_output_format != "csv") {
+    fprintf(stderr, "unknown output format %s\n",
+            FLAGS_output_format.c_str());
+    exit(1);
+  }
+  if (FLAGS_arrival_dist != "poisson" && FLAGS_arrival_dist != "constant") {
+    fprintf(stderr, "unknown arrival distribution %s\n",
+            FLAGS_arrival_dist.c_str());
+    exit(1);
+  }
+  if (FLAGS_use_typed_cache &&
+      (!FLAGS_trace_file.empty() || !FLAGS_record_trace.empty())) {
+    fprintf(stderr, "traces need a Cache, not TypedCache\n");
+    exit(1);
+  }
+  if (FLAGS_loader_latency_us > 0 && FLAGS_use_typed_cache) {
+    fprintf(stderr, "the simulated loader needs a Cache, not TypedCache\n");
+    exit(1);
+  }
+  if (!FLAGS_cache_types.empty()) {
+    std::vector<std::string> cache_types;
+    rocksdb::ParseNameList(FLAGS_cache_types, &cache_types);
+    for (const std::string& cache_type : cache_types) {
+      if (cache_type != "lru" && cache_type != "clock") {
+        fprintf(stderr, "unknown cache type %s; cache_types takes lru, clock\n",
+                cache_type.c_str());
+        exit(1);
+      }
+    }
+    // The replayed ops are plain lookups, inserts and erases.
+    if (FLAGS_use_typed_cache || !FLAGS_record_trace.empty() ||
+        FLAGS_multi_lookup_batch > 1 || FLAGS_use_get_copy ||
+        FLAGS_loader_latency_us > 0) {
+      fprintf(stderr,
+              "cache_types does not go with use_typed_cache, record_trace, "
+              "multi_lookup_batch, use_get_copy or loader_latency_us\n");
+      exit(1);
+    }
+    // The largest run's ops are all drawn before it starts.
+    uint64_t max_threads = FLAGS_threads;
+    std::vector<int> threads;
+    if (!FLAGS_sweep_threads.empty()) {
+      rocksdb::ParseIntList(FLAGS_sweep_threads, &threads);
+      max_threads = *std::max_element(threads.begin(), threads.end());
+    }
+    double workload_mb = static_cast<double>(max_threads) *
+                         FLAGS_ops_per_thread *
+                         rocksdb::kWorkloadBytesPerOp / (1 << 20);
+    if (FLAGS_trace_file.empty() && workload_mb > FLAGS_workload_mb) {
+      fprintf(stderr,
+              "cache_types would draw %.0f MB of ops, over workload_mb = "
+              "%d; lower threads or ops_per_thread\n",
+              workload_mb, FLAGS_workload_mb);
+      exit(1);
+    }
+  }
+  if (FLAGS_duration_sec < 0 || FLAGS_usage_sample_ms < 0) {
+    fprintf(stderr, "duration_sec and usage_sample_ms must be >= 0\n");
+    exit(1);
+  }
+  rocksdb::ValueSizeGenerator::Distribution value_dist;
+  if (!rocksdb::ValueSizeGenerator::ParseDistribution(FLAGS_value_size_dist,
+                                                      &value_dist)) {
+    fprintf(stderr, "unknown value size distribution %s\n",
+            FLAGS_value_size_dist.c_str());
+    exit(1);
+  }
+  if (FLAGS_value_size < 0) {
+    fprintf(stderr, "value_size < 0\n");
+    exit(1);
+  }
+  if (FLAGS_value_size > 0 && FLAGS_use_typed_cache) {
+    fprintf(stderr, "value_size needs a Cache, not TypedCache\n");
+    exit(1);
+  }
+  if (value_dist == rocksdb::ValueSizeGenerator::kBimodal &&
+      (FLAGS_bimodal_large_fraction < 0 || FLAGS_bimodal_large_fraction > 1 ||
+       FLAGS_bimodal_large_ratio < 1)) {
+    fprintf(stderr,
+            "bimodal_large_fraction must be in [0, 1] and "
+            "bimodal_large_ratio >= 1\n");
+    exit(1);
+  }
+
   rocksdb::CacheBench bench;
   if (FLAGS_populate_cache) {
     bench.PopulateCache();
@@ -15,7 +15,14 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#if defined(OS_MACOSX) || defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__linux__)
+#include <malloc.h>
+#endif
 
 // We want to give users opportunity to default all the mutexes to adaptive if
 // not specified otherwise. This enables a quick way to conduct various
@@ -41,8 +48,86 @@ namespace port {
 		return result;
 	}
 
+#ifdef ROCKSDB_MUTEX_CONTENTION_PROFILE
+	extern const bool kMutexContentionProfile = true;
+
+	namespace {
+	// Guards ProfiledMutexes(). A plain pthread mutex, since a port::Mutex
+	// would count itself.
+	pthread_mutex_t profiled_mutexes_mu = PTHREAD_MUTEX_INITIALIZER;
+
+	// The mutexes named with SetProfileName(). Never freed, so that mutexes
+	// destroyed during exit can still remove themselves.
+	std::vector<Mutex*>* ProfiledMutexes() {
+		static std::vector<Mutex*>* mutexes = new std::vector<Mutex*>();
+		return mutexes;
+	}
+
+	// Only read around a lock that has to wait anyway, where a vDSO clock read
+	// is noise.
+	uint64_t ProfileNowNanos() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	}  // namespace
+
+	void Mutex::SetProfileName(const char* site, int instance) {
+		PthreadCall("lock", pthread_mutex_lock(&profiled_mutexes_mu));
+		if (profile_site_ == nullptr) {
+			ProfiledMutexes()->push_back(this);
+		}
+		profile_site_ = site;
+		profile_instance_ = instance;
+		PthreadCall("unlock", pthread_mutex_unlock(&profiled_mutexes_mu));
+	}
+
+	std::vector<MutexContention> GetMutexContention() {
+		std::vector<MutexContention> result;
+		PthreadCall("lock", pthread_mutex_lock(&profiled_mutexes_mu));
+		for (Mutex* mu : *ProfiledMutexes()) {
+			result.push_back(MutexContention{
+					mu->profile_site_, mu->profile_instance_,
+					mu->acquisitions_.load(std::memory_order_relaxed),
+					mu->contended_.load(std::memory_order_relaxed),
+					mu->wait_nanos_.load(std::memory_order_relaxed)});
+		}
+		PthreadCall("unlock", pthread_mutex_unlock(&profiled_mutexes_mu));
+		std::sort(result.begin(), result.end(),
+				[](const MutexContention& a, const MutexContention& b) {
+					int cmp = strcmp(a.site, b.site);
+					return cmp != 0 ? cmp < 0 : a.instance < b.instance;
+				});
+		return result;
+	}
+
+	void ResetMutexContention() {
+		PthreadCall("lock", pthread_mutex_lock(&profiled_mutexes_mu));
+		for (Mutex* mu : *ProfiledMutexes()) {
+			mu->acquisitions_.store(0, std::memory_order_relaxed);
+			mu->contended_.store(0, std::memory_order_relaxed);
+			mu->wait_nanos_.store(0, std::memory_order_relaxed);
+		}
+		PthreadCall("unlock", pthread_mutex_unlock(&profiled_mutexes_mu));
+	}
+#else
+	extern const bool kMutexContentionProfile = false;
+
+	std::vector<MutexContention> GetMutexContention() {
+		return std::vector<MutexContention>();
+	}
+
+	void ResetMutexContention() {}
+#endif  // ROCKSDB_MUTEX_CONTENTION_PROFILE
+
 	Mutex::Mutex(bool adaptive) {
 		(void) adaptive;
+#ifdef ROCKSDB_MUTEX_CONTENTION_PROFILE
+		acquisitions_.store(0, std::memory_order_relaxed);
+		contended_.store(0, std::memory_order_relaxed);
+		wait_nanos_.store(0, std::memory_order_relaxed);
+		profile_site_ = nullptr;
+		profile_instance_ = 0;
+#endif
 #ifdef ROCKSDB_PTHREAD_ADAPTIVE_MUTEX
 		if (!adaptive) {
 	PthreadCall("init mutex", pthread_mutex_init(&mu_, nullptr));
@@ -61,10 +146,37 @@ namespace port {
 #endif // ROCKSDB_PTHREAD_ADAPTIVE_MUTEX
 	}
 
-	Mutex::~Mutex() { PthreadCall("destroy mutex", pthread_mutex_destroy(&mu_)); }
+	Mutex::~Mutex() {
+#ifdef ROCKSDB_MUTEX_CONTENTION_PROFILE
+		if (profile_site_ != nullptr) {
+			PthreadCall("lock", pthread_mutex_lock(&profiled_mutexes_mu));
+			std::vector<Mutex*>* mutexes = ProfiledMutexes();
+			mutexes->erase(std::find(mutexes->begin(), mutexes->end(), this));
+			PthreadCall("unlock", pthread_mutex_unlock(&profiled_mutexes_mu));
+		}
+#endif
+		PthreadCall("destroy mutex", pthread_mutex_destroy(&mu_));
+	}
 
 	void Mutex::Lock() {
+#ifdef ROCKSDB_MUTEX_CONTENTION_PROFILE
+		int result = pthread_mutex_trylock(&mu_);
+		if (result == EBUSY) {
+			uint64_t start = ProfileNowNanos();
+			PthreadCall("lock", pthread_mutex_lock(&mu_));
+			uint64_t waited = ProfileNowNanos() - start;
+			contended_.store(contended_.load(std::memory_order_relaxed) + 1,
+					std::memory_order_relaxed);
+			wait_nanos_.store(wait_nanos_.load(std::memory_order_relaxed) + waited,
+					std::memory_order_relaxed);
+		} else {
+			PthreadCall("trylock", result);
+		}
+		acquisitions_.store(acquisitions_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+#else
 		PthreadCall("lock", pthread_mutex_lock(&mu_));
+#endif
 #ifndef NDEBUG
 		locked_ = true;
 #endif
@@ -208,5 +320,19 @@ namespace port {
 		free(memblock);
 	}
 
+#if defined(OS_MACOSX) || defined(__APPLE__)
+	size_t MallocUsableSize(void* p, size_t /*allocation_size*/) {
+		return malloc_size(p);
+	}
+#elif defined(__linux__)
+	size_t MallocUsableSize(void* p, size_t /*allocation_size*/) {
+		return malloc_usable_size(p);
+	}
+#else
+	size_t MallocUsableSize(void* /*p*/, size_t allocation_size) {
+		return allocation_size;
+	}
+#endif
+
 
 }  // namespace port